@@ -21,147 +21,1389 @@
  * Use 'w' and 's' to change the flap's angle and see the forces change.
  *
  * How to Compile:
- * gcc -o aero_sim_v4 aero_sim_v4.c -lncurses -lm
+ * gcc -O2 -march=native -ffp-contract=off -pthread -o aero_sim aero_sim.c -lncurses -lm
+ * (-march=native enables the AVX/SSE update kernel; without it a scalar loop is used.
+ * -ffp-contract=off stops FMA targets fusing multiply-adds, so a --seed run gives
+ * the same numbers whichever kernel was compiled in, with --collisions too)
  *
  * How to Run:
- * ./aero_sim_v4
+ * ./aero_sim
+ *
+ * Headless batch mode (no ncurses, no frame throttling):
+ * ./aero_sim --headless --steps 5000 --width 200 --height 60 --seed 42
+ * Add --threads N (0 = all cores) to split the particle update across a worker pool.
+ * --density D sets the particle count to width * height * D * PARTICLES_PER_CELL.
+ * --engine lbm runs the D2Q9 lattice-Boltzmann solver instead of particles
+ * (also selectable from the 'm' menu).
+ *
+ * Polar sweep (one simulation per configuration, --threads run concurrently):
+ * ./aero_sim --sweep --shapes flap,aerofoil --angles -0.5:0.5:0.1 --speeds 0.4:1.2:0.4 \
+ *            --warmup 300 --steps 1000 --out polar.csv   (.json for JSON output)
+ * --collisions adds DSMC-style particle-particle collisions (menu option 5).
+ * --scene FILE replaces the built-in shape with polygon / NACA 4-digit bodies
+ * (one per line, see multi_element.scene); lift/drag are also reported per body
+ * and W/S rotate the last body of the scene. W/S (and --angles in a sweep) rotate
+ * the built-in shapes about their centre as well, not just the flap.
+ * --record FILE streams a binary recording (every --record-every N steps, with
+ * --record-delta for delta-encoded positions); --replay FILE plays it back:
+ * LBM steps are stored as the flow speed shading of every cell. --collisions
+ * re-sorts the particles every step, so --record-delta saves little with it.
+ * Space play/pause, Left/Right step a frame, Up/Down skip 10%, q quit.
+ * Interactive runs step on a physics thread at --sim-rate HZ steps per second
+ * (default 60, 0 = as fast as possible) while the terminal redraws at 60 FPS.
+ * --dt T moves particles T frames per step; collisions are swept, so large steps do
+ * not tunnel through thin objects.
+ * With --rel-error E, headless and sweep runs stop early once the standard error
+ * of lift and drag falls below E times the mean force (--steps becomes the cap).
  * =================================================================================
  */
 
 #include <ncurses.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <stdint.h>
 #include <math.h>
 #include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define MAX_PARTICLES 10000
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define PARTICLES_PER_CELL 5.0 // Particles per screen cell at density 1.0
 #define INITIAL_DENSITY 0.3
 #define INITIAL_SPEED 0.8
 
+// Defaults for the headless batch mode
+#define HEADLESS_STEPS 1000
+#define HEADLESS_WIDTH 160
+#define HEADLESS_HEIGHT 48
+#define HEADLESS_SEED 1
+#define DEFAULT_WARMUP 200
+#define DEFAULT_SIM_RATE 60.0  // Interactive physics steps per second
+#define DISPLAY_RATE 60.0      // Interactive frames per second
+#define COMMAND_QUEUE_SIZE 64  // Pending input commands (power of two)
+#define RECORD_VERSION 2
+#define RECORD_QUEUE 8              // Chunk buffers in flight to the writer thread
+#define RECORD_KEYFRAME_INTERVAL 32 // Delta recordings store full positions this often
+#define DENSITY_LEVELS 9       // Glyph/colour levels of the density ramp
+#define DENSITY_MEAN_LEVEL 3.0f // Level of a cell holding the free-stream mean
+#define MAX_SWEEP_CASES 100000
+
+// Force statistics
+#define STATS_EMA_ALPHA 0.05   // Smoothing of the gauge readout
+#define STATS_MAX_BATCHES 64   // Batch means kept before adjacent batches are merged
+#define STATS_MIN_BATCHES 16   // Fewer batches than this never count as converged
+#define STATS_MIN_SAMPLES 256  // Nor do fewer steps than this
+
+#define MAX_THREADS 64
+
+// Lattice-Boltzmann engine parameters (lattice units)
+#define LBM_TAU 0.56f          // BGK relaxation time; viscosity = (tau - 0.5) / 3
+#define LBM_SPEED_SCALE 0.05f  // Inlet lattice velocity per unit of air_speed
+#define LBM_FORCE_SCALE 100.0f // Momentum-exchange force to gauge units
+#define LBM_BLOCK 128          // Columns per cache block in the stream/collide kernel
+
+// Random numbers: Philox4x32-10, generated in groups of RNG_GROUP_BLOCKS counters
+#define RNG_GROUP_BLOCKS 8
+#define RNG_GROUP_WORDS (4 * RNG_GROUP_BLOCKS)
+#define REINJECT_CHUNK 256     // Exiting particles reinjected per batch
+
+// Particle-particle collisions (DSMC-style)
+#define DSMC_CELL 2              // Collision cell size in screen cells
+#define DSMC_PAIR_FRACTION 0.5f  // Candidate pairs per cell = fraction * particles in the cell * time step
+#define DSMC_REL_SPEED 0.5f      // Relative speed at which a candidate pair always collides
+
+// Scenes
+#define MAX_BODIES 16          // Bodies per scene; body ids are stored per grid cell
+#define NACA_POINTS 40         // Points per surface of a generated NACA profile
+#define SCENE_ASPECT 0.5f      // Terminal cells are about twice as tall as wide
+
 // A simple 2D vector for physics calculations
 typedef struct {
     float x, y;
 } Vector2D;
 
+// Particles are stored as structure-of-arrays so the free-stream update can
+// stream through x/y/vx/vy with SIMD loads instead of striding over structs.
+// The arrays are heap-allocated on cache-line boundaries and only grow; a
+// smaller particle count keeps the allocation.
+#define PARTICLE_ALIGN 64
+
 typedef struct {
-    Vector2D pos; // Position
-    Vector2D vel; // Velocity
-} Particle;
+    float *x, *y;
+    float *vx, *vy;
+    int *slow_list; // Indices that need the bounds/collision slow path
+    int capacity;
+} ParticleArrays;
 
 typedef enum {
     SHAPE_FLAP,
     SHAPE_AEROFOIL,
     SHAPE_CIRCLE,
-    SHAPE_SQUARE
+    SHAPE_SQUARE,
+    SHAPE_SCENE     // The bodies of the loaded scene
 } ShapeType;
 
 typedef struct {
     ShapeType type;
     Vector2D pos;
     Vector2D size;
-    float angle; // Angle in radians for the flap
+    float angle; // Angle in radians for the flap (for scenes, added to the last body)
 } Shape;
 
+// One rigid body of a scene: a closed polygon in body coordinates (cells,
+// x along the chord, y up), placed with its origin at pos and pitched nose-up
+// by angle radians
+typedef struct {
+    char name[24];
+    Vector2D *vertices;
+    int num_vertices;
+    Vector2D pos;
+    float angle;
+} Body;
+
+typedef struct {
+    Body bodies[MAX_BODIES];
+    int num_bodies;
+} Scene;
+
+// Rasterized copy of the object: occupancy plus an outward surface normal per
+// cell taken from a signed distance field. Rebuilt only when the shape changes,
+// so a collision test is a single table lookup.
+typedef struct {
+    Shape key;           // Shape the grid was built from
+    int valid;
+    int x0, y0;          // Screen cell of grid[0]
+    int width, height;
+    int capacity;        // Allocated cells
+    unsigned char *solid;
+    unsigned char *body; // Scene body of each solid cell (0 for single shapes)
+    float *sdf;          // Negative inside, positive outside (in cells)
+    Vector2D *normal;
+    unsigned int version; // Bumped on every rebuild
+} ObstacleGrid;
+
+typedef enum {
+    ENGINE_PARTICLES,
+    ENGINE_LBM
+} EngineType;
+
+// Uniform cell grid for particle-particle collisions. Every step the particles
+// are counting-sorted into cell order (scattered into the spare arrays, which
+// are then swapped with the particle arrays), so each cell's particles are
+// contiguous and neighbouring cells stay close in memory.
+typedef struct {
+    int cells_x, cells_y;
+    int *cell_start;       // First particle of each cell, plus the total at the end
+    int *offsets;          // num_workers x cells histograms, then scatter offsets
+    int num_workers;
+    int range_total[MAX_THREADS]; // Particles in each worker's cell range
+    float *x, *y, *vx, *vy;       // Scatter targets
+    int capacity;
+} CollisionGrid;
+
+// D2Q9 lattice over the whole domain. Distributions are stored per direction
+// (f[q * cells + cell]) so the kernel streams each direction contiguously.
+typedef struct {
+    int width, height;
+    float *f[2];            // Post-collision populations, current and next
+    int cur;
+    unsigned char *solid;   // Domain-wide copy of the obstacle grid
+    unsigned int obstacle_version;
+} Lattice;
+
+// Persistent worker threads. The calling thread acts as worker 0, so a pool
+// of one thread runs tasks inline without any synchronisation.
+typedef void (*PoolTask)(void *ctx, int worker, int num_workers);
+
+typedef struct WorkerPool WorkerPool;
+
+typedef struct {
+    WorkerPool *pool;
+    int id;
+} PoolThreadArg;
+
+struct WorkerPool {
+    pthread_t threads[MAX_THREADS];
+    PoolThreadArg args[MAX_THREADS];
+    int num_threads;
+    pthread_barrier_t start, done;
+    PoolTask task;
+    void *ctx;
+    int quit;
+};
+
+// Running statistics of one force component. The standard error comes from
+// batch means: samples are grouped into batches, and whenever there are
+// 2 * STATS_MAX_BATCHES of them adjacent pairs are merged and the batch size
+// doubles, so batches end up much longer than the correlation time and their
+// means are close to independent.
+typedef struct {
+    double ema;
+    long count;
+    double mean, m2; // Welford mean / sum of squared deviations
+    double batches[2 * STATS_MAX_BATCHES];
+    int num_batches;
+    int batch_size;
+    double batch_sum;
+    int batch_fill;
+} RunningStat;
+
+// Lift/drag statistics for the current configuration
+typedef struct {
+    RunningStat lift, drag;
+    // Per-body readout for scenes: running sums for the mean and smoothed values
+    int num_bodies;
+    long body_samples;
+    double body_lift_sum[MAX_BODIES], body_drag_sum[MAX_BODIES];
+    float body_lift_ema[MAX_BODIES], body_drag_ema[MAX_BODIES];
+    // Configuration the samples belong to; any change restarts the statistics
+    unsigned int obstacle_version;
+    float air_speed, air_density;
+    int engine;
+} ForceStats;
+
+// Counter-based random stream: block n of stream s under key k is
+// Philox(k, {n, s}), so streams split by id and any block can be recomputed.
+typedef struct {
+    uint32_t key[2];
+    uint32_t stream;
+    uint64_t counter;              // Next block group
+    uint32_t buf[RNG_GROUP_WORDS]; // Group consumed by single draws
+    int buf_pos;
+} Rng;
+
+// Everything a worker writes during a step is private to it, and each slot
+// starts on its own cache line so neighbouring workers never share one
+#define CACHE_LINE 64
+
+typedef struct {
+    Vector2D force; // Lift/drag accumulated by this worker's particles or lattice rows
+    Vector2D body_force[MAX_BODIES]; // The same split by scene body
+    Rng rng;        // Reinjection and collision draws
+} __attribute__((aligned(CACHE_LINE))) WorkerSlot;
+
+typedef struct Recorder Recorder;
+
 // A central struct to hold the entire simulation state
 typedef struct {
-    Particle particles[MAX_PARTICLES];
+    EngineType engine;
+    ParticleArrays particles;
     int num_particles;
+    Lattice lattice;
+    int collisions;       // Particle-particle collisions on/off
+    CollisionGrid collision_grid;
     int screen_width, screen_height;
     float air_speed;
     float air_density;
+    float time_step;      // Particle step length in frames (1 = move by vel once)
     Shape object;
+    Scene scene;          // Bodies used when object.type is SHAPE_SCENE
+    ObstacleGrid obstacle;
     Vector2D total_force; // NEW: To accumulate forces from collisions
+    Vector2D body_force[MAX_BODIES]; // Force on each scene body this step
+    ForceStats stats;     // Running lift/drag statistics over steps
+    unsigned int seed;
+    Rng spawn_rng;        // Places particles added when the density grows
+    WorkerPool *pool;     // NULL runs the update on the calling thread
+    WorkerSlot workers[MAX_THREADS];
+    Recorder *recorder;   // Captures steps to a recording when set
 } SimState;
 
+// Inclusive range of values for a sweep axis: start, start + step, ... <= end
+typedef struct {
+    float start, end, step;
+} SweepRange;
+
+// Command line options
+typedef struct {
+    int headless;
+    int steps;
+    int width, height; // Virtual grid size for headless runs
+    unsigned int seed;
+    int seed_set;
+    int threads;
+    float density;
+    float time_step;
+    EngineType engine;
+    int collisions;
+    int sweep;
+    SweepRange angles, speeds, densities;
+    unsigned int shape_mask; // Bit per ShapeType
+    int warmup;
+    const char *out_path;
+    double rel_error; // Stop condition for batch runs, 0 = run all steps
+    double sim_rate;  // Interactive steps per second, 0 = as fast as possible
+    const char *record_path;
+    int record_every;
+    int record_delta;
+    const char *replay_path;
+    const char *scene_path;
+} RunOptions;
+
+// One configuration of a sweep and its time-averaged result
+typedef struct {
+    ShapeType shape;
+    float angle, speed, density;
+    double lift, drag;
+    double lift_se, drag_se;
+    int steps;
+} SweepCase;
+
+// Input from the render thread to the physics thread
+typedef enum {
+    CMD_FLAP_ANGLE,     // Adds value to the flap angle
+    CMD_NEXT_SHAPE,
+    CMD_SPEED_STEP,
+    CMD_DENSITY_STEP,
+    CMD_TOGGLE_ENGINE,
+    CMD_TOGGLE_COLLISIONS,
+    CMD_QUIT
+} CommandType;
+
+typedef struct {
+    CommandType type;
+    float value;
+} Command;
+
+// Single-producer single-consumer ring; head and tail only ever grow
+typedef struct {
+    Command items[COMMAND_QUEUE_SIZE];
+    unsigned int head, tail;
+} CommandQueue;
+
+// What the render thread draws: a copy of the simulation taken by the physics thread
+typedef struct {
+    int screen_width, screen_height;
+    EngineType engine;
+    int collisions;
+    ShapeType shape;
+    float angle, air_speed, air_density;
+    float lift_ema, drag_ema;
+    double lift_mean, drag_mean, lift_se, drag_se;
+    int have_stats;
+    int num_bodies;                         // Per-body readout, scenes only
+    const char *body_names[MAX_BODIES];     // Owned by the scene, which never changes once loaded
+    float body_lift[MAX_BODIES], body_drag[MAX_BODIES];
+    double steps_per_sec;
+    unsigned char *levels;   // Particle density or LBM speed level per cell, 0 = blank
+    int levels_capacity;
+    ObstacleGrid obstacle;   // Solid mask only, copied when its version changes
+} Frame;
+
+// Frames published without locks. The physics thread fills frames[write] and
+// swaps it with ready; the render thread swaps ready with frames[read] when a
+// fresh frame is flagged. Neither ever waits on the other.
+#define FRAME_FRESH 4
+typedef struct {
+    Frame frames[3];
+    int write, read;
+    int ready;      // Frame index, | FRAME_FRESH when not yet taken
+} FrameExchange;
+
+// Per-worker particle count grids for the density histogram
+typedef struct {
+    unsigned int *counts;
+    int capacity;
+} DensityBins;
+
+typedef struct {
+    SimState *state;
+    double step_rate;   // 0 = as fast as possible
+    CommandQueue commands;
+    FrameExchange frames;
+    DensityBins bins;
+    pthread_t thread;
+} SimThread;
+
+// What is on the terminal: the field glyph last sent for every cell, and the
+// obstacle mask rasterized for the frame's obstacle version
+typedef struct {
+    int width, height;
+    chtype *shown;          // 0 = unknown, redraw
+    unsigned char *shape;
+    unsigned int shape_version;
+    int shape_valid;
+    int colors;
+} Renderer;
+
+// Recording file layout, in host byte order (little-endian on x86): one
+// RecordHeader, then one RecordFrame + payload per recorded step. Positions
+// are quantized to 16 bits across the domain; the payload is x[] then y[],
+// either raw uint16 or zigzag varint deltas from the previous frame. LBM
+// steps store the width * height display levels of the flow speed instead.
+#define RECORD_MAGIC "AEROREC"
+#define RECORD_FRAME_MAGIC 0x4D415246u // "FRAM"
+#define RECORD_FLAG_DELTA 1u
+
+enum { RECORD_RAW, RECORD_DELTA, RECORD_LEVELS };
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;   // Readers skip fields added by newer versions
+    uint32_t width, height;
+    uint32_t seed;
+    uint32_t engine;
+    uint32_t collisions;
+    uint32_t record_every;
+    uint32_t flags;
+    float time_step;
+} RecordHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t payload_size;  // Bytes following this struct
+    uint64_t step;
+    uint32_t num_particles;
+    uint32_t encoding;      // RECORD_RAW, RECORD_DELTA or RECORD_LEVELS
+    float lift, drag;
+    uint32_t shape;
+    float angle, air_speed, air_density;
+    float shape_pos[2], shape_size[2];
+} RecordFrame;
+
+typedef struct {
+    unsigned char *data;
+    size_t size, capacity;
+} RecordChunk;
+
+// Single-producer single-consumer ring of chunk indices
+typedef struct {
+    int items[RECORD_QUEUE];
+    unsigned int head, tail;
+} ChunkRing;
+
+// Frames are encoded on the stepping thread into a fixed set of chunks and
+// written by a background thread. When every chunk is still queued the frame
+// is dropped, so the step loop never waits for the disk.
+struct Recorder {
+    FILE *file;
+    const char *path;
+    int every, delta;
+    uint64_t step;
+    unsigned int frames, dropped;
+    int write_error;
+    RecordChunk chunks[RECORD_QUEUE];
+    ChunkRing full, spare;  // To the writer, and back from it
+    sem_t ready;
+    int quit;
+    pthread_t thread;
+    uint16_t *prev_x, *prev_y; // Quantized positions of the last queued frame
+    int prev_count, prev_capacity;
+    int since_keyframe;
+};
+
 // --- Function Prototypes ---
+void parse_options(int argc, char **argv, RunOptions *opts);
+double now_seconds(void);
+int run_headless(const RunOptions *opts);
+int run_sweep(const RunOptions *opts);
+WorkerPool *pool_create(int num_threads);
+void pool_run(WorkerPool *pool, PoolTask task, void *ctx);
+void pool_destroy(WorkerPool *pool);
 void init_simulation(SimState *state);
-void reset_particle(SimState *state, int i);
-void handle_particle_collision(Particle *p, const Shape *object);
+void set_shape_type(SimState *state, ShapeType type);
+const char *shape_type_name(ShapeType type);
+void set_particle_count(SimState *state);
+void free_simulation(SimState *state);
+void rng_init(Rng *rng, uint64_t seed, uint32_t stream);
+void rng_uniform(Rng *rng, float *out, int n);
+void reinject_particles(SimState *state, const int *list, int n, Rng *rng);
+int is_inside_shape(int x, int y, const Shape *object);
+void obstacle_grid_update(ObstacleGrid *grid, const Shape *object, const Scene *scene);
+int scene_load(Scene *scene, const char *path);
+void scene_free(Scene *scene);
+int use_scene(SimState *state, const char *path);
+void obstacle_grid_free(ObstacleGrid *grid);
+void handle_particle_collision(Vector2D *vel, Vector2D normal);
 void update_simulation(SimState *state);
-void draw_frame(const SimState *state);
-void show_menu(SimState *state);
+void force_stats_reset(ForceStats *fs);
+double stat_variance(const RunningStat *st);
+double stat_std_error(const RunningStat *st);
+double force_stats_rel_error(const ForceStats *fs);
+void lattice_step(SimState *state);
+void collide_particles(SimState *state);
+void collision_grid_free(CollisionGrid *cg);
+void lattice_free(Lattice *lat);
+Recorder *recorder_open(const char *path, const SimState *state, int every, int delta);
+void recorder_close(Recorder *rec);
+void record_step(Recorder *rec, const SimState *state);
+int run_replay(const RunOptions *opts);
+void sim_thread_start(SimThread *sim);
+void sim_thread_stop(SimThread *sim);
+int command_push(CommandQueue *q, CommandType type, float value);
+const Frame *frame_acquire(FrameExchange *ex);
+void sleep_until(double *deadline, double interval);
+void renderer_init(Renderer *r);
+void renderer_free(Renderer *r);
+void draw_frame(Renderer *r, const Frame *frame);
+void draw_menu(Renderer *r, const Frame *frame);
 
 // --- Main Loop ---
-int main() {
+int main(int argc, char **argv) {
+    RunOptions opts;
+    parse_options(argc, argv, &opts);
+    if (opts.replay_path) return run_replay(&opts);
+    if (opts.sweep) return run_sweep(&opts);
+    if (opts.headless) return run_headless(&opts);
+
     initscr();
     noecho();
     cbreak();
     curs_set(0);
     nodelay(stdscr, TRUE);
-    srand(time(NULL));
     
-    SimState state;
+    SimState state = {0};
+    getmaxyx(stdscr, state.screen_height, state.screen_width);
+    state.seed = opts.seed_set ? opts.seed : (unsigned int)time(NULL);
+    state.pool = pool_create(opts.threads);
+    state.time_step = opts.time_step;
     init_simulation(&state);
+    if (opts.density != state.air_density) {
+        state.air_density = opts.density;
+        set_particle_count(&state);
+    }
+    state.engine = opts.engine;
+    state.collisions = opts.collisions;
+    if (opts.scene_path && use_scene(&state, opts.scene_path)) {
+        endwin();
+        free_simulation(&state);
+        return 1;
+    }
+    if (opts.record_path) {
+        state.recorder = recorder_open(opts.record_path, &state, opts.record_every, opts.record_delta);
+        if (state.recorder == NULL) {
+            endwin();
+            free_simulation(&state);
+            return 1;
+        }
+    }
 
-    while (1) {
-        int ch = getch();
-        if (ch == 'q') break;
-        if (ch == 'm') show_menu(&state);
+    // Physics runs on its own thread; this one only reads input and draws
+    SimThread sim = {0};
+    sim.state = &state;
+    sim.step_rate = opts.sim_rate;
+    sim_thread_start(&sim);
 
-        // --- REAL-TIME FLAP CONTROL ---
-        if (state.object.type == SHAPE_FLAP) {
-            if (ch == 'w' || ch == 'W') state.object.angle -= 0.1;
-            if (ch == 's' || ch == 'S') state.object.angle += 0.1;
+    Renderer renderer;
+    renderer_init(&renderer);
+    int menu_open = 0, running = 1;
+    double next_frame = now_seconds();
+    while (running) {
+        int ch;
+        while ((ch = getch()) != ERR) {
+            if (menu_open) {
+                switch (ch) {
+                    case '1': command_push(&sim.commands, CMD_NEXT_SHAPE, 0); break;
+                    case '2': command_push(&sim.commands, CMD_SPEED_STEP, 0); break;
+                    case '3': command_push(&sim.commands, CMD_DENSITY_STEP, 0); break;
+                    case '4': command_push(&sim.commands, CMD_TOGGLE_ENGINE, 0); break;
+                    case '5': command_push(&sim.commands, CMD_TOGGLE_COLLISIONS, 0); break;
+                    case 'm': case 'q': menu_open = 0; break;
+                }
+                continue;
+            }
+            if (ch == 'q') running = 0;
+            if (ch == 'm') menu_open = 1;
+
+            // --- REAL-TIME FLAP CONTROL ---
+            if (ch == 'w' || ch == 'W') command_push(&sim.commands, CMD_FLAP_ANGLE, -0.1f);
+            if (ch == 's' || ch == 'S') command_push(&sim.commands, CMD_FLAP_ANGLE, 0.1f);
         }
+        if (!running) break;
 
-        update_simulation(&state);
-        draw_frame(&state);
-        usleep(16000); // ~60 FPS
+        const Frame *frame = frame_acquire(&sim.frames);
+        draw_frame(&renderer, frame);
+        if (menu_open) draw_menu(&renderer, frame);
+        refresh();
+        sleep_until(&next_frame, 1.0 / DISPLAY_RATE);
     }
 
+    sim_thread_stop(&sim);
+    renderer_free(&renderer);
     endwin();
+    recorder_close(state.recorder);
+    free_simulation(&state);
+    return 0;
+}
+
+// --- Command Line and Headless Mode ---
+// "start:end:step" or a single value
+static SweepRange parse_range(const char *arg) {
+    SweepRange r = {0, 0, 1};
+    int n = sscanf(arg, "%f:%f:%f", &r.start, &r.end, &r.step);
+    if (n < 2) r.end = r.start;
+    if (n < 3 || !(r.step > 0)) r.step = r.end > r.start ? r.end - r.start : 1;
+    return r;
+}
+
+static int range_count(const SweepRange *r) {
+    if (r->end < r->start) return 1;
+    return (int)floorf((r->end - r->start) / r->step + 1e-4f) + 1;
+}
+
+static unsigned int parse_shapes(const char *arg) {
+    unsigned int mask = 0;
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", arg);
+    for (char *tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        for (int t = SHAPE_FLAP; t <= SHAPE_SQUARE; t++) {
+            if (strcasecmp(tok, shape_type_name((ShapeType)t)) == 0) mask |= 1u << t;
+        }
+    }
+    return mask;
+}
+
+enum {
+    OPT_SWEEP = 256,
+    OPT_ANGLES,
+    OPT_SPEEDS,
+    OPT_DENSITIES,
+    OPT_SHAPES,
+    OPT_WARMUP,
+    OPT_OUT,
+    OPT_REL_ERROR,
+    OPT_DT,
+    OPT_COLLISIONS,
+    OPT_SIM_RATE,
+    OPT_RECORD,
+    OPT_RECORD_EVERY,
+    OPT_RECORD_DELTA,
+    OPT_REPLAY,
+    OPT_SCENE
+};
+
+void parse_options(int argc, char **argv, RunOptions *opts) {
+    opts->headless = 0;
+    opts->steps = HEADLESS_STEPS;
+    opts->width = HEADLESS_WIDTH;
+    opts->height = HEADLESS_HEIGHT;
+    opts->seed = HEADLESS_SEED;
+    opts->seed_set = 0;
+    opts->threads = 1;
+    opts->density = INITIAL_DENSITY;
+    opts->engine = ENGINE_PARTICLES;
+    opts->sweep = 0;
+    opts->angles = (SweepRange){0, 0, 1};
+    opts->speeds = (SweepRange){INITIAL_SPEED, INITIAL_SPEED, 1};
+    opts->densities = (SweepRange){INITIAL_DENSITY, INITIAL_DENSITY, 1};
+    opts->shape_mask = 1u << SHAPE_FLAP;
+    opts->warmup = DEFAULT_WARMUP;
+    opts->out_path = NULL;
+    opts->rel_error = 0.0;
+    opts->time_step = 1.0f;
+    opts->collisions = 0;
+    opts->sim_rate = DEFAULT_SIM_RATE;
+    opts->record_path = NULL;
+    opts->record_every = 1;
+    opts->record_delta = 0;
+    opts->replay_path = NULL;
+    opts->scene_path = NULL;
+
+    static const struct option long_opts[] = {
+        {"headless", no_argument,       NULL, 'H'},
+        {"steps",    required_argument, NULL, 'n'},
+        {"width",    required_argument, NULL, 'x'},
+        {"height",   required_argument, NULL, 'y'},
+        {"seed",     required_argument, NULL, 's'},
+        {"threads",  required_argument, NULL, 't'},
+        {"density",  required_argument, NULL, 'd'},
+        {"engine",   required_argument, NULL, 'e'},
+        {"sweep",    no_argument,       NULL, OPT_SWEEP},
+        {"angles",   required_argument, NULL, OPT_ANGLES},
+        {"speeds",   required_argument, NULL, OPT_SPEEDS},
+        {"densities", required_argument, NULL, OPT_DENSITIES},
+        {"shapes",   required_argument, NULL, OPT_SHAPES},
+        {"warmup",   required_argument, NULL, OPT_WARMUP},
+        {"out",      required_argument, NULL, OPT_OUT},
+        {"rel-error", required_argument, NULL, OPT_REL_ERROR},
+        {"dt",       required_argument, NULL, OPT_DT},
+        {"collisions", no_argument,     NULL, OPT_COLLISIONS},
+        {"sim-rate", required_argument, NULL, OPT_SIM_RATE},
+        {"record",   required_argument, NULL, OPT_RECORD},
+        {"record-every", required_argument, NULL, OPT_RECORD_EVERY},
+        {"record-delta", no_argument,   NULL, OPT_RECORD_DELTA},
+        {"replay",   required_argument, NULL, OPT_REPLAY},
+        {"scene",    required_argument, NULL, OPT_SCENE},
+        {"help",     no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "Hn:x:y:s:t:d:e:h", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'H': opts->headless = 1; break;
+            case 'n': opts->steps = atoi(optarg); break;
+            case 'x': opts->width = atoi(optarg); break;
+            case 'y': opts->height = atoi(optarg); break;
+            case 's': opts->seed = (unsigned int)strtoul(optarg, NULL, 10); opts->seed_set = 1; break;
+            case 't': opts->threads = atoi(optarg); break;
+            case 'd': opts->density = strtof(optarg, NULL); break;
+            case 'e': opts->engine = strcmp(optarg, "lbm") == 0 ? ENGINE_LBM : ENGINE_PARTICLES; break;
+            case OPT_SWEEP: opts->sweep = 1; break;
+            case OPT_ANGLES: opts->angles = parse_range(optarg); break;
+            case OPT_SPEEDS: opts->speeds = parse_range(optarg); break;
+            case OPT_DENSITIES: opts->densities = parse_range(optarg); break;
+            case OPT_SHAPES: opts->shape_mask = parse_shapes(optarg); break;
+            case OPT_WARMUP: opts->warmup = atoi(optarg); break;
+            case OPT_OUT: opts->out_path = optarg; break;
+            case OPT_REL_ERROR: opts->rel_error = strtod(optarg, NULL); break;
+            case OPT_DT: opts->time_step = strtof(optarg, NULL); break;
+            case OPT_COLLISIONS: opts->collisions = 1; break;
+            case OPT_SIM_RATE: opts->sim_rate = strtod(optarg, NULL); break;
+            case OPT_RECORD: opts->record_path = optarg; break;
+            case OPT_RECORD_EVERY: opts->record_every = atoi(optarg); break;
+            case OPT_RECORD_DELTA: opts->record_delta = 1; break;
+            case OPT_REPLAY: opts->replay_path = optarg; break;
+            case OPT_SCENE: opts->scene_path = optarg; break;
+            case 'h':
+            default:
+                fprintf(stderr, "Usage: %s [--headless] [--steps N] [--width W] [--height H] [--seed S] [--threads N] [--density D] [--engine particles|lbm]\n"
+                                "          [--warmup N] [--rel-error E] [--dt STEP] [--collisions]\n"
+                                "          [--sim-rate HZ] [--record FILE] [--record-every N] [--record-delta] [--scene FILE]\n"
+                                "       %s --replay FILE [--threads N] [--scene FILE]\n"
+                                "       %s --sweep [--shapes flap,aerofoil,circle,square] [--angles A0:A1:STEP] [--speeds S0:S1:STEP]\n"
+                                "          [--densities D0:D1:STEP] [--warmup N] [--steps N] [--out polar.csv|polar.json]\n", argv[0], argv[0], argv[0]);
+                exit(c == 'h' ? 0 : 1);
+        }
+    }
+
+    if (opts->steps < 1) opts->steps = 1;
+    if (opts->width < 8) opts->width = 8;
+    if (opts->height < 8) opts->height = 8;
+    if (!(opts->density > 0)) opts->density = INITIAL_DENSITY;
+    if (opts->threads <= 0) opts->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (opts->threads < 1) opts->threads = 1;
+    if (opts->threads > MAX_THREADS) opts->threads = MAX_THREADS;
+    if (opts->warmup < 0) opts->warmup = 0;
+    if (!(opts->rel_error > 0)) opts->rel_error = 0.0;
+    if (!(opts->time_step > 0)) opts->time_step = 1.0f;
+    if (opts->shape_mask == 0) opts->shape_mask = 1u << SHAPE_FLAP;
+    if (opts->record_every < 1) opts->record_every = 1;
+}
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Samples lift/drag for up to max_steps steps with fresh statistics. With
+// rel_error > 0 it stops as soon as the relative standard error drops below it.
+// Returns the number of steps taken.
+static int measure_forces(SimState *state, int max_steps, double rel_error) {
+    force_stats_reset(&state->stats);
+    int step = 0;
+    while (step < max_steps) {
+        update_simulation(state);
+        step++;
+        if (rel_error > 0 && force_stats_rel_error(&state->stats) < rel_error) break;
+    }
+    return step;
+}
+
+// Zeroed SimState on the heap, aligned for its worker slots (calloc only guarantees 16 bytes)
+static SimState *sim_state_alloc(void) {
+    SimState *state = aligned_alloc(_Alignof(SimState), sizeof(SimState));
+    if (state != NULL) memset(state, 0, sizeof(SimState));
+    return state;
+}
+
+// Runs the solver without ncurses on a virtual grid and reports throughput
+int run_headless(const RunOptions *opts) {
+    SimState *state = sim_state_alloc();
+    if (state == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    state->screen_width = opts->width;
+    state->screen_height = opts->height;
+    state->seed = opts->seed;
+    state->pool = pool_create(opts->threads);
+    state->time_step = opts->time_step;
+    init_simulation(state);
+    if (opts->density != state->air_density) {
+        state->air_density = opts->density;
+        set_particle_count(state);
+    }
+    state->engine = opts->engine;
+    state->collisions = opts->collisions;
+    if (opts->scene_path && use_scene(state, opts->scene_path)) {
+        free_simulation(state);
+        free(state);
+        return 1;
+    }
+    if (opts->record_path) {
+        state->recorder = recorder_open(opts->record_path, state, opts->record_every, opts->record_delta);
+        if (state->recorder == NULL) {
+            free_simulation(state);
+            free(state);
+            return 1;
+        }
+    }
+
+    for (int step = 0; step < opts->warmup; step++) update_simulation(state);
+    double t_start = now_seconds();
+    int steps = measure_forces(state, opts->steps, opts->rel_error);
+    double elapsed = now_seconds() - t_start;
+    recorder_close(state->recorder);
+    state->recorder = NULL;
+
+    if (state->engine == ENGINE_LBM) {
+        double cell_updates = (double)state->screen_width * state->screen_height * steps;
+        printf("grid: %dx%d  engine: lbm  steps: %d  threads: %d\n",
+               state->screen_width, state->screen_height, steps, state->pool->num_threads);
+        printf("elapsed: %.3f s  throughput: %.3e cell-updates/s\n",
+               elapsed, elapsed > 0 ? cell_updates / elapsed : 0.0);
+    } else {
+        double particle_steps = (double)state->num_particles * steps;
+        printf("grid: %dx%d  particles: %d  steps: %d  seed: %u  threads: %d%s\n",
+               state->screen_width, state->screen_height, state->num_particles, steps, opts->seed,
+               state->pool->num_threads, state->collisions ? "  collisions: on" : "");
+        printf("elapsed: %.3f s  throughput: %.3e particle-steps/s\n",
+               elapsed, elapsed > 0 ? particle_steps / elapsed : 0.0);
+    }
+    const ForceStats *fs = &state->stats;
+    printf("mean lift: %.5f +- %.5f  mean drag: %.5f +- %.5f\n",
+           fs->lift.mean, stat_std_error(&fs->lift), fs->drag.mean, stat_std_error(&fs->drag));
+    printf("per-step std dev: lift %.5f  drag %.5f\n", sqrt(stat_variance(&fs->lift)), sqrt(stat_variance(&fs->drag)));
+    if (state->object.type == SHAPE_SCENE && fs->body_samples > 0) {
+        for (int b = 0; b < fs->num_bodies; b++) {
+            printf("  %-12s mean lift: %.5f  mean drag: %.5f\n", state->scene.bodies[b].name,
+                   fs->body_lift_sum[b] / fs->body_samples, fs->body_drag_sum[b] / fs->body_samples);
+        }
+    }
+    if (opts->rel_error > 0) {
+        double rel = force_stats_rel_error(fs);
+        printf("relative error: %.4f (target %.4f, %s after %d steps)\n", rel, opts->rel_error,
+               rel < opts->rel_error ? "converged" : "not converged", steps);
+    }
+
+    free_simulation(state);
+    free(state);
+    return 0;
+}
+
+// --- Polar Sweep ---
+typedef struct {
+    const RunOptions *opts;
+    SweepCase *cases;
+    int num_cases;
+    int next_case; // Claimed with an atomic increment
+} SweepJob;
+
+// Runs one configuration on the calling thread: warm-up, then average over opts->steps
+// (or fewer with --rel-error)
+static void run_sweep_case(const RunOptions *opts, SweepCase *c) {
+    SimState *state = sim_state_alloc();
+    if (state == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    state->screen_width = opts->width;
+    state->screen_height = opts->height;
+    state->seed = opts->seed;
+    state->pool = pool_create(1);
+    state->time_step = opts->time_step;
+    init_simulation(state);
+    state->engine = opts->engine;
+    state->collisions = opts->collisions;
+    set_shape_type(state, c->shape);
+    state->object.angle = c->angle;
+    state->air_speed = c->speed;
+    state->air_density = c->density;
+    // Reseed every particle so the case starts from its own inflow, not the default one
+    state->num_particles = 0;
+    set_particle_count(state);
+
+    for (int step = 0; step < opts->warmup; step++) update_simulation(state);
+
+    c->steps = measure_forces(state, opts->steps, opts->rel_error);
+    c->lift = state->stats.lift.mean;
+    c->drag = state->stats.drag.mean;
+    c->lift_se = stat_std_error(&state->stats.lift);
+    c->drag_se = stat_std_error(&state->stats.drag);
+
+    free_simulation(state);
+    free(state);
+}
+
+static void *sweep_thread_main(void *arg) {
+    SweepJob *job = arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&job->next_case, 1, __ATOMIC_RELAXED);
+        if (i >= job->num_cases) break;
+        run_sweep_case(job->opts, &job->cases[i]);
+    }
+    return NULL;
+}
+
+static void write_sweep_results(FILE *out, const SweepCase *cases, int num_cases, int json) {
+    if (json) fprintf(out, "[\n");
+    else fprintf(out, "shape,angle,speed,density,lift,drag,lift_se,drag_se,steps\n");
+    for (int i = 0; i < num_cases; i++) {
+        const SweepCase *c = &cases[i];
+        if (json) {
+            fprintf(out, "  {\"shape\": \"%s\", \"angle\": %.4f, \"speed\": %.4f, \"density\": %.4f, "
+                         "\"lift\": %.6f, \"drag\": %.6f, \"lift_se\": %.6f, \"drag_se\": %.6f, \"steps\": %d}%s\n",
+                    shape_type_name(c->shape), c->angle, c->speed, c->density, c->lift, c->drag,
+                    c->lift_se, c->drag_se, c->steps, i + 1 < num_cases ? "," : "");
+        } else {
+            fprintf(out, "%s,%.4f,%.4f,%.4f,%.6f,%.6f,%.6f,%.6f,%d\n",
+                    shape_type_name(c->shape), c->angle, c->speed, c->density, c->lift, c->drag,
+                    c->lift_se, c->drag_se, c->steps);
+        }
+    }
+    if (json) fprintf(out, "]\n");
+}
+
+// Runs every combination of shape x angle x speed x density as an independent
+// single-threaded simulation, --threads of them at a time, and writes a polar table
+int run_sweep(const RunOptions *opts) {
+    int num_shapes = __builtin_popcount(opts->shape_mask);
+    int na = range_count(&opts->angles), ns = range_count(&opts->speeds), nd = range_count(&opts->densities);
+    long total = (long)num_shapes * na * ns * nd;
+    if (total > MAX_SWEEP_CASES) {
+        fprintf(stderr, "Sweep has %ld configurations (limit %d)\n", total, MAX_SWEEP_CASES);
+        return 1;
+    }
+
+    SweepJob job = {opts, calloc(total, sizeof(SweepCase)), 0, 0};
+    if (job.cases == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    for (int t = SHAPE_FLAP; t <= SHAPE_SQUARE; t++) {
+        if (!(opts->shape_mask & (1u << t))) continue;
+        for (int a = 0; a < na; a++)
+            for (int sp = 0; sp < ns; sp++)
+                for (int d = 0; d < nd; d++) {
+                    SweepCase *c = &job.cases[job.num_cases++];
+                    c->shape = (ShapeType)t;
+                    c->angle = opts->angles.start + a * opts->angles.step;
+                    c->speed = opts->speeds.start + sp * opts->speeds.step;
+                    c->density = opts->densities.start + d * opts->densities.step;
+                }
+    }
+
+    int num_threads = opts->threads < job.num_cases ? opts->threads : job.num_cases;
+    pthread_t threads[MAX_THREADS];
+    double t_start = now_seconds();
+    // Cases are taken from a shared counter, so if a thread cannot be started the
+    // ones already running (and this one) simply share the remaining cases
+    for (int t = 1; t < num_threads; t++) {
+        if (pthread_create(&threads[t], NULL, sweep_thread_main, &job) != 0) {
+            fprintf(stderr, "sweep: could only start %d of %d threads\n", t, num_threads);
+            num_threads = t;
+            break;
+        }
+    }
+    sweep_thread_main(&job);
+    for (int t = 1; t < num_threads; t++) pthread_join(threads[t], NULL);
+    double elapsed = now_seconds() - t_start;
+
+    FILE *out = stdout;
+    int json = 0;
+    if (opts->out_path != NULL) {
+        out = fopen(opts->out_path, "w");
+        if (out == NULL) {
+            perror(opts->out_path);
+            free(job.cases);
+            return 1;
+        }
+        const char *ext = strrchr(opts->out_path, '.');
+        json = ext != NULL && strcasecmp(ext, ".json") == 0;
+    }
+    write_sweep_results(out, job.cases, job.num_cases, json);
+    if (out != stdout) fclose(out);
+
+    fprintf(stderr, "sweep: %d configurations, %d warm-up + up to %d averaged steps each, %d threads, %.3f s\n",
+            job.num_cases, opts->warmup, opts->steps, num_threads, elapsed);
+    free(job.cases);
     return 0;
 }
 
+// --- Worker Pool ---
+static void *pool_thread_main(void *arg);
+
+WorkerPool *pool_create(int num_threads) {
+    WorkerPool *pool = calloc(1, sizeof(WorkerPool));
+    if (pool == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    pool->num_threads = num_threads;
+    if (num_threads == 1) return pool;
+
+    pthread_barrier_init(&pool->start, NULL, num_threads);
+    pthread_barrier_init(&pool->done, NULL, num_threads);
+    for (int t = 1; t < num_threads; t++) {
+        pool->args[t] = (PoolThreadArg){pool, t};
+        pthread_create(&pool->threads[t], NULL, pool_thread_main, &pool->args[t]);
+    }
+    return pool;
+}
+
+static void *pool_thread_main(void *arg) {
+    PoolThreadArg *a = arg;
+    WorkerPool *pool = a->pool;
+    for (;;) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->quit) break;
+        pool->task(pool->ctx, a->id, pool->num_threads);
+        pthread_barrier_wait(&pool->done);
+    }
+    return NULL;
+}
+
+// Runs task on every worker and returns once all of them have finished
+void pool_run(WorkerPool *pool, PoolTask task, void *ctx) {
+    if (pool->num_threads == 1) {
+        task(ctx, 0, 1);
+        return;
+    }
+    pool->task = task;
+    pool->ctx = ctx;
+    pthread_barrier_wait(&pool->start);
+    task(ctx, 0, pool->num_threads);
+    pthread_barrier_wait(&pool->done);
+}
+
+void pool_destroy(WorkerPool *pool) {
+    if (pool == NULL) return;
+    if (pool->num_threads > 1) {
+        pool->quit = 1;
+        pthread_barrier_wait(&pool->start);
+        for (int t = 1; t < pool->num_threads; t++) pthread_join(pool->threads[t], NULL);
+        pthread_barrier_destroy(&pool->start);
+        pthread_barrier_destroy(&pool->done);
+    }
+    free(pool);
+}
+
+// Splits [0, n) into one range per worker, keeping range starts on multiples of align
+static void worker_range(int n, int worker, int num_workers, int align, int *begin, int *end) {
+    int chunk = (n + num_workers - 1) / num_workers;
+    chunk = (chunk + align - 1) / align * align;
+    *begin = worker * chunk;
+    *end = *begin + chunk;
+    if (*begin > n) *begin = n;
+    if (*end > n) *end = n;
+}
+
 // --- Simulation Initialization ---
+const char *shape_type_name(ShapeType type) {
+    switch (type) {
+        case SHAPE_FLAP: return "Flap";
+        case SHAPE_SQUARE: return "Square";
+        case SHAPE_AEROFOIL: return "Aerofoil";
+        case SHAPE_CIRCLE: return "Circle";
+        case SHAPE_SCENE: return "Scene";
+        default: return "Unknown";
+    }
+}
+
+// Switches the object to a shape type with its default size, centred at one third of the domain
+void set_shape_type(SimState *state, ShapeType type) {
+    state->object.type = type;
+    state->object.pos = (Vector2D){state->screen_width / 3, state->screen_height / 2};
+    if (type == SHAPE_FLAP) state->object.size = (Vector2D){25, 4};
+    else if (type == SHAPE_AEROFOIL) state->object.size = (Vector2D){25, 8};
+    else state->object.size = (Vector2D){15, 15};
+}
+
+// The caller sets screen_width/screen_height (from ncurses or the headless grid) first.
 void init_simulation(SimState *state) {
-    getmaxyx(stdscr, state->screen_height, state->screen_width);
-    
     state->air_speed = INITIAL_SPEED;
     state->air_density = INITIAL_DENSITY;
     state->total_force = (Vector2D){0, 0}; // Initialize forces
+    if (!(state->time_step > 0)) state->time_step = 1.0f;
     
-    state->object.type = SHAPE_FLAP;
-    state->object.size = (Vector2D){25, 4};
-    state->object.pos = (Vector2D){state->screen_width / 3, state->screen_height / 2};
+    set_shape_type(state, SHAPE_FLAP);
     state->object.angle = 0.0f;
+    state->obstacle.valid = 0;
+
+    // Each worker draws from its own stream, so results never depend on thread timing
+    for (int t = 0; t < MAX_THREADS; t++) {
+        state->workers[t].force = (Vector2D){0, 0};
+        rng_init(&state->workers[t].rng, state->seed, (uint32_t)(t + 1));
+    }
+
+    rng_init(&state->spawn_rng, state->seed, 0);
+    state->num_particles = 0;
+    set_particle_count(state);
+}
+
+static float *alloc_particle_array(size_t count, size_t elem_size) {
+    // aligned_alloc needs a size that is a multiple of the alignment
+    size_t bytes = (count * elem_size + PARTICLE_ALIGN - 1) / PARTICLE_ALIGN * PARTICLE_ALIGN;
+    void *ptr = aligned_alloc(PARTICLE_ALIGN, bytes ? bytes : PARTICLE_ALIGN);
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+// Grows the arrays to hold at least count particles, keeping the first 'keep'
+static void grow_particle_pool(ParticleArrays *p, int count, int keep) {
+    if (count <= p->capacity) return;
+    int capacity = p->capacity + p->capacity / 2;
+    if (capacity < count) capacity = count;
+
+    float **arrays[4] = {&p->x, &p->y, &p->vx, &p->vy};
+    for (int a = 0; a < 4; a++) {
+        float *grown = alloc_particle_array(capacity, sizeof(float));
+        if (keep > 0) memcpy(grown, *arrays[a], keep * sizeof(float));
+        free(*arrays[a]);
+        *arrays[a] = grown;
+    }
+    free(p->slow_list);
+    p->slow_list = (int *)alloc_particle_array(capacity, sizeof(int));
+    p->capacity = capacity;
+}
+
+// Sizes the particle count from the domain area and air density. Existing
+// particles are kept; only particles added by a density increase get new
+// random positions, and shrinking just drops the tail.
+void set_particle_count(SimState *state) {
+    double target = (double)state->screen_width * state->screen_height * state->air_density * PARTICLES_PER_CELL;
+    if (target > INT_MAX - 64) target = INT_MAX - 64;
+    int count = (int)target;
+    if (count < 1) count = 1;
+
+    int old_count = state->num_particles;
+    grow_particle_pool(&state->particles, count, old_count);
+
+    ParticleArrays *p = &state->particles;
+    if (count > old_count) {
+        rng_uniform(&state->spawn_rng, p->x + old_count, count - old_count);
+        rng_uniform(&state->spawn_rng, p->y + old_count, count - old_count);
+    }
+    float width = (float)state->screen_width, height = (float)state->screen_height;
+    for (int i = old_count; i < count; i++) {
+        p->x[i] *= width;
+        p->y[i] *= height;
+        p->vx[i] = state->air_speed;
+        p->vy[i] = 0;
+    }
+    state->num_particles = count;
+}
+
+void free_simulation(SimState *state) {
+    ParticleArrays *p = &state->particles;
+    free(p->x);
+    free(p->y);
+    free(p->vx);
+    free(p->vy);
+    free(p->slow_list);
+    *p = (ParticleArrays){0};
+    state->num_particles = 0;
+    obstacle_grid_free(&state->obstacle);
+    scene_free(&state->scene);
+    lattice_free(&state->lattice);
+    collision_grid_free(&state->collision_grid);
+    pool_destroy(state->pool);
+    state->pool = NULL;
+}
+
+// Puts the listed particles back at the inlet with a jittered free-stream
+// velocity. Draws come in one batch per chunk, planar: rows, then vx, then vy.
+void reinject_particles(SimState *state, const int *list, int n, Rng *rng) {
+    ParticleArrays *p = &state->particles;
+    float height = (float)state->screen_height, speed = state->air_speed;
+    float u[3 * REINJECT_CHUNK];
+    for (int start = 0; start < n; start += REINJECT_CHUNK) {
+        int m = n - start < REINJECT_CHUNK ? n - start : REINJECT_CHUNK;
+        float *ys = u, *vxs = u + m, *vys = u + 2 * m;
+        rng_uniform(rng, u, 3 * m);
+        for (int k = 0; k < m; k++) {
+            ys[k] *= height;
+            vxs[k] = speed + (vxs[k] - 0.5f) * 0.2f;
+            vys[k] = (vys[k] - 0.5f) * 0.1f;
+        }
+        for (int k = 0; k < m; k++) {
+            int i = list[start + k];
+            p->x[i] = 0;
+            p->y[i] = ys[k];
+            p->vx[i] = vxs[k];
+            p->vy[i] = vys[k];
+        }
+    }
+}
+
+
+// --- Random Numbers ---
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+void rng_init(Rng *rng, uint64_t seed, uint32_t stream) {
+    rng->key[0] = (uint32_t)seed;
+    rng->key[1] = (uint32_t)(seed >> 32);
+    rng->stream = stream;
+    rng->counter = 0;
+    rng->buf_pos = RNG_GROUP_WORDS;
+}
+
+// Fills out with the next RNG_GROUP_BLOCKS blocks, word-major:
+// out[w * RNG_GROUP_BLOCKS + b] is word w of block b. The SIMD paths run the
+// blocks in lanes and produce exactly the scalar output.
+static void philox_group(Rng *rng, uint32_t *out) {
+    uint64_t n = rng->counter;
+    rng->counter += RNG_GROUP_BLOCKS;
+    int b = 0;
+
+#if defined(__AVX2__)
+    {
+        const __m256i m0 = _mm256_set1_epi32((int)PHILOX_M0), m1 = _mm256_set1_epi32((int)PHILOX_M1);
+        const __m256i low = _mm256_set1_epi64x(0xFFFFFFFFll);
+        __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)(uint32_t)n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        // Carry into the high counter word for lanes whose low word wrapped
+        __m256i wrapped = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_set1_epi32((int)(uint32_t)n), _mm256_set1_epi32(INT_MIN)),
+                                             _mm256_xor_si256(c0, _mm256_set1_epi32(INT_MIN)));
+        __m256i c1 = _mm256_sub_epi32(_mm256_set1_epi32((int)(uint32_t)(n >> 32)), wrapped);
+        __m256i c2 = _mm256_set1_epi32((int)rng->stream), c3 = _mm256_setzero_si256();
+        uint32_t k0 = rng->key[0], k1 = rng->key[1];
+        for (int r = 0; r < 10; r++) {
+            // 32x32 -> 64 bit products of the even lanes, then of the odd lanes
+            __m256i e0 = _mm256_mul_epu32(c0, m0), o0 = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), m0);
+            __m256i e1 = _mm256_mul_epu32(c2, m1), o1 = _mm256_mul_epu32(_mm256_srli_epi64(c2, 32), m1);
+            __m256i lo0 = _mm256_or_si256(_mm256_and_si256(e0, low), _mm256_slli_epi64(o0, 32));
+            __m256i hi0 = _mm256_or_si256(_mm256_srli_epi64(e0, 32), _mm256_andnot_si256(low, o0));
+            __m256i lo1 = _mm256_or_si256(_mm256_and_si256(e1, low), _mm256_slli_epi64(o1, 32));
+            __m256i hi1 = _mm256_or_si256(_mm256_srli_epi64(e1, 32), _mm256_andnot_si256(low, o1));
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)k0));
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)k1));
+            c1 = lo1;
+            c3 = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        _mm256_storeu_si256((__m256i *)&out[0 * RNG_GROUP_BLOCKS], c0);
+        _mm256_storeu_si256((__m256i *)&out[1 * RNG_GROUP_BLOCKS], c1);
+        _mm256_storeu_si256((__m256i *)&out[2 * RNG_GROUP_BLOCKS], c2);
+        _mm256_storeu_si256((__m256i *)&out[3 * RNG_GROUP_BLOCKS], c3);
+        b = RNG_GROUP_BLOCKS;
+    }
+#elif defined(__SSE2__)
+    for (; b + 4 <= RNG_GROUP_BLOCKS; b += 4) {
+        const __m128i m0 = _mm_set1_epi32((int)PHILOX_M0), m1 = _mm_set1_epi32((int)PHILOX_M1);
+        const __m128i low = _mm_set1_epi64x(0xFFFFFFFFll);
+        uint64_t first = n + (uint64_t)b;
+        __m128i c0 = _mm_add_epi32(_mm_set1_epi32((int)(uint32_t)first), _mm_setr_epi32(0, 1, 2, 3));
+        __m128i wrapped = _mm_cmpgt_epi32(_mm_xor_si128(_mm_set1_epi32((int)(uint32_t)first), _mm_set1_epi32(INT_MIN)),
+                                          _mm_xor_si128(c0, _mm_set1_epi32(INT_MIN)));
+        __m128i c1 = _mm_sub_epi32(_mm_set1_epi32((int)(uint32_t)(first >> 32)), wrapped);
+        __m128i c2 = _mm_set1_epi32((int)rng->stream), c3 = _mm_setzero_si128();
+        uint32_t k0 = rng->key[0], k1 = rng->key[1];
+        for (int r = 0; r < 10; r++) {
+            __m128i e0 = _mm_mul_epu32(c0, m0), o0 = _mm_mul_epu32(_mm_srli_epi64(c0, 32), m0);
+            __m128i e1 = _mm_mul_epu32(c2, m1), o1 = _mm_mul_epu32(_mm_srli_epi64(c2, 32), m1);
+            __m128i lo0 = _mm_or_si128(_mm_and_si128(e0, low), _mm_slli_epi64(o0, 32));
+            __m128i hi0 = _mm_or_si128(_mm_srli_epi64(e0, 32), _mm_andnot_si128(low, o0));
+            __m128i lo1 = _mm_or_si128(_mm_and_si128(e1, low), _mm_slli_epi64(o1, 32));
+            __m128i hi1 = _mm_or_si128(_mm_srli_epi64(e1, 32), _mm_andnot_si128(low, o1));
+            c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int)k0));
+            c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int)k1));
+            c1 = lo1;
+            c3 = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        _mm_storeu_si128((__m128i *)&out[0 * RNG_GROUP_BLOCKS + b], c0);
+        _mm_storeu_si128((__m128i *)&out[1 * RNG_GROUP_BLOCKS + b], c1);
+        _mm_storeu_si128((__m128i *)&out[2 * RNG_GROUP_BLOCKS + b], c2);
+        _mm_storeu_si128((__m128i *)&out[3 * RNG_GROUP_BLOCKS + b], c3);
+    }
+#endif
+
+    // Scalar fallback
+    for (; b < RNG_GROUP_BLOCKS; b++) {
+        uint64_t ctr = n + (uint64_t)b;
+        uint32_t c0 = (uint32_t)ctr, c1 = (uint32_t)(ctr >> 32), c2 = rng->stream, c3 = 0;
+        uint32_t k0 = rng->key[0], k1 = rng->key[1];
+        for (int r = 0; r < 10; r++) {
+            uint64_t p0 = (uint64_t)PHILOX_M0 * c0, p1 = (uint64_t)PHILOX_M1 * c2;
+            c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            c1 = (uint32_t)p1;
+            c3 = (uint32_t)p0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        out[0 * RNG_GROUP_BLOCKS + b] = c0;
+        out[1 * RNG_GROUP_BLOCKS + b] = c1;
+        out[2 * RNG_GROUP_BLOCKS + b] = c2;
+        out[3 * RNG_GROUP_BLOCKS + b] = c3;
+    }
+}
+
+// Top 24 bits -> [0, 1), exactly representable
+static inline float rng_to_float(uint32_t u) {
+    return (float)(u >> 8) * (1.0f / 16777216.0f);
+}
 
-    state->num_particles = (int)(MAX_PARTICLES * state->air_density);
-    if (state->num_particles > MAX_PARTICLES) state->num_particles = MAX_PARTICLES;
+// Writes n uniform floats in [0, 1). Whole groups are consumed, so the
+// sequence depends only on the seed, the stream and the sizes requested.
+void rng_uniform(Rng *rng, float *out, int n) {
+    uint32_t words[RNG_GROUP_WORDS];
+    for (int start = 0; start < n; start += RNG_GROUP_WORDS) {
+        int m = n - start < RNG_GROUP_WORDS ? n - start : RNG_GROUP_WORDS;
+        philox_group(rng, words);
+        for (int k = 0; k < m; k++) out[start + k] = rng_to_float(words[k]);
+    }
+}
 
-    for (int i = 0; i < state->num_particles; i++) {
-        state->particles[i].pos = (Vector2D){(float)(rand() % state->screen_width), (float)(rand() % state->screen_height)};
-        state->particles[i].vel = (Vector2D){state->air_speed, 0};
+static inline uint32_t rng_next(Rng *rng) {
+    if (rng->buf_pos == RNG_GROUP_WORDS) {
+        philox_group(rng, rng->buf);
+        rng->buf_pos = 0;
     }
+    return rng->buf[rng->buf_pos++];
+}
+
+static inline float rng_float(Rng *rng) {
+    return rng_to_float(rng_next(rng));
 }
 
-void reset_particle(SimState *state, int i) {
-    state->particles[i].pos.x = 0;
-    state->particles[i].pos.y = (float)(rand() % state->screen_height);
-    state->particles[i].vel.x = state->air_speed + ((float)rand() / RAND_MAX - 0.5f) * 0.2f;
-    state->particles[i].vel.y = ((float)rand() / RAND_MAX - 0.5f) * 0.1f;
+// Uniform integer in [0, n)
+static inline int rng_below(Rng *rng, int n) {
+    return (int)(((uint64_t)rng_next(rng) * (uint64_t)n) >> 32);
 }
 
 
 // --- Physics and Collision ---
 int is_inside_shape(int x, int y, const Shape *object) {
-    float center_x = object->pos.x;
-    float center_y = object->pos.y;
+    // Every shape turns by object->angle about its centre, so test the cell in the shape's own frame.
+    // Cells are twice as tall as wide: rotate in square units, then go back to rows
+    float dx = x - object->pos.x;
+    float dy = (y - object->pos.y) / SCENE_ASPECT;
+    float cos_a = cosf(-object->angle);
+    float sin_a = sinf(-object->angle);
+    float rotated_x = dx * cos_a - dy * sin_a;
+    float rotated_y = (dx * sin_a + dy * cos_a) * SCENE_ASPECT;
 
     if (object->type == SHAPE_FLAP) {
-        float dx = x - center_x;
-        float dy = y - center_y;
-        float cos_a = cosf(-object->angle);
-        float sin_a = sinf(-object->angle);
-        float rotated_x = dx * cos_a - dy * sin_a;
-        float rotated_y = dx * sin_a + dy * cos_a;
         return (fabs(rotated_x) < object->size.x / 2.0f && fabs(rotated_y) < object->size.y / 2.0f);
     }
     
-    // Bounding box for non-rotating shapes
+    // Bounding box in the shape's frame
     float half_w = object->size.x / 2.0f;
     float half_h = object->size.y / 2.0f;
-    if (x < center_x - half_w || x >= center_x + half_w || y < center_y - half_h || y >= center_y + half_h) {
+    if (rotated_x < -half_w || rotated_x >= half_w || rotated_y < -half_h || rotated_y >= half_h) {
         return 0; 
     }
     // Specific shape checks for non-rectangular shapes
@@ -169,102 +1411,1522 @@ int is_inside_shape(int x, int y, const Shape *object) {
         case SHAPE_SQUARE: return 1;
         case SHAPE_CIRCLE: {
             float radius = object->size.x / 2.0f;
-            float aspect = 2.0f;
-            float dx = (x - center_x);
-            float dy = (y - center_y) * aspect;
-            return (dx * dx + dy * dy < radius * radius);
+            float cy = rotated_y / SCENE_ASPECT;
+            return (rotated_x * rotated_x + cy * cy < radius * radius);
         }
         case SHAPE_AEROFOIL: {
-            float norm_x = (x - (center_x - half_w)) / object->size.x;
+            float norm_x = (rotated_x + half_w) / object->size.x;
             if (norm_x < 0 || norm_x > 1) return 0;
             float thickness = 0.5f * (0.2969f * sqrtf(norm_x) - 0.1260f * norm_x - 0.3516f * powf(norm_x, 2) + 0.2843f * powf(norm_x, 3) - 0.1015f * powf(norm_x, 4));
-            return fabs(y - center_y) < object->size.y * thickness;
+            return fabs(rotated_y) < object->size.y * thickness;
         }
         default: return 0;
     }
 }
 
-void handle_particle_collision(Particle *p, const Shape *object) {
-    Vector2D normal = {-1, 0}; // Default normal for head-on collision
-    if (object->type == SHAPE_FLAP) {
-        float cos_a = cosf(object->angle);
-        float sin_a = sinf(object->angle);
-        Vector2D local_vel = {p->vel.x * cos_a + p->vel.y * sin_a, -p->vel.x * sin_a + p->vel.y * cos_a};
-        if (local_vel.y > 0) { normal = (Vector2D){sin_a, -cos_a}; } 
-        else { normal = (Vector2D){-sin_a, cos_a}; }
+// --- Scenes ---
+// Closed NACA 4-digit profile of the given chord: trailing edge, upper surface
+// to the leading edge, then back along the lower surface (cosine spacing)
+static int naca_profile(Body *body, const char *code, float chord) {
+    if (strlen(code) != 4 || strspn(code, "0123456789") != 4) return 1;
+    float m = (code[0] - '0') / 100.0f, p = (code[1] - '0') / 10.0f;
+    float t = ((code[2] - '0') * 10 + (code[3] - '0')) / 100.0f;
+    if (t <= 0.0f || (m > 0.0f && p == 0.0f)) return 1;
+
+    int n = NACA_POINTS;
+    body->vertices = malloc((2 * n - 1) * sizeof(Vector2D));
+    if (body->vertices == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
     }
-    
-    float restitution = 0.4f, friction = 0.8f;
-    float vel_dot_normal = p->vel.x * normal.x + p->vel.y * normal.y;
-    Vector2D normal_vel = {normal.x * vel_dot_normal, normal.y * vel_dot_normal};
-    Vector2D tangent_vel = {p->vel.x - normal_vel.x, p->vel.y - normal_vel.y};
-    p->vel.x = (tangent_vel.x * friction) - (normal_vel.x * restitution);
-    p->vel.y = (tangent_vel.y * friction) - (normal_vel.y * restitution);
+    body->num_vertices = 2 * n - 1;
+    for (int i = 0; i < n; i++) {
+        float x = 0.5f * (1.0f - cosf((float)M_PI * (float)(n - 1 - i) / (float)(n - 1)));
+        // Closed trailing edge variant of the thickness polynomial
+        float yt = 5.0f * t * (0.2969f * sqrtf(x) - 0.1260f * x - 0.3516f * x * x + 0.2843f * x * x * x - 0.1036f * x * x * x * x);
+        float yc = 0.0f, slope = 0.0f;
+        if (m > 0.0f) {
+            float q = x < p ? p : 1.0f - p;
+            yc = m / (q * q) * (x < p ? 2 * p * x - x * x : (1 - 2 * p) + 2 * p * x - x * x);
+            slope = 2 * m / (q * q) * (p - x);
+        }
+        float theta = atanf(slope), st = sinf(theta), ct = cosf(theta);
+        body->vertices[i] = (Vector2D){(x - yt * st) * chord, (yc + yt * ct) * chord};
+        if (i < n - 1) body->vertices[2 * n - 2 - i] = (Vector2D){(x + yt * st) * chord, (yc - yt * ct) * chord};
+    }
+    return 0;
 }
 
-void update_simulation(SimState *state) {
-    state->total_force = (Vector2D){0, 0}; // Reset forces each frame
+static int scene_error(const char *path, int line, const char *msg) {
+    fprintf(stderr, "%s:%d: %s\n", path, line, msg);
+    return 1;
+}
 
-    for (int i = 0; i < state->num_particles; i++) {
-        Particle *p = &state->particles[i];
-        Vector2D last_pos = p->pos;
-        Vector2D vel_before = p->vel;
+// Reads up to max floats from the rest of the line; returns how many were read, -1 on junk
+static int parse_floats(char **save, float *out, int max) {
+    int n = 0;
+    char *tok;
+    while ((tok = strtok_r(NULL, " \t\r\n", save)) != NULL) {
+        char *end;
+        float v = strtof(tok, &end);
+        if (*end != '\0' || n == max) return -1;
+        out[n++] = v;
+    }
+    return n;
+}
 
-        p->pos.x += p->vel.x;
-        p->pos.y += p->vel.y;
+// Loads a scene file. One body per line ('#' starts a comment), positions in
+// screen cells, angles in degrees nose-up:
+//   naca    NAME CODE CHORD X Y ANGLE      (X, Y: leading edge)
+//   polygon NAME X Y ANGLE X1 Y1 X2 Y2 ... (vertices in body cells, y up)
+// Returns 0 on success; on failure reports "file:line: message" and leaves the scene empty.
+int scene_load(Scene *scene, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    scene_free(scene);
 
-        if (p->pos.x >= state->screen_width || p->pos.x < 0 || p->pos.y >= state->screen_height || p->pos.y < 0) {
-            reset_particle(state, i);
-            continue;
-        }
+    char line[4096];
+    int lineno = 0, failed = 0;
+    float values[2 * 256 + 3];
+    while (!failed && fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *save;
+        char *kind = strtok_r(line, " \t\r\n", &save);
+        if (kind == NULL) continue;
+        char *name = strtok_r(NULL, " \t\r\n", &save);
+        if (name == NULL) { failed = scene_error(path, lineno, "missing body name"); break; }
+        if (scene->num_bodies == MAX_BODIES) { failed = scene_error(path, lineno, "too many bodies"); break; }
 
-        if (is_inside_shape((int)roundf(p->pos.x), (int)roundf(p->pos.y), &state->object)) {
-            p->pos = last_pos;
-            handle_particle_collision(p, &state->object);
-            
-            // --- ACCUMULATE FORCES ---
-            // The force on the object is the opposite of the change in the particle's momentum
-            state->total_force.x += vel_before.x - p->vel.x; // Drag
-            state->total_force.y += vel_before.y - p->vel.y; // Lift
-            
-            p->pos.x += p->vel.x; // Bounce-out step
-            p->pos.y += p->vel.y;
+        Body *body = &scene->bodies[scene->num_bodies];
+        memset(body, 0, sizeof(*body));
+        snprintf(body->name, sizeof(body->name), "%s", name);
+        if (strcmp(kind, "naca") == 0) {
+            char *code = strtok_r(NULL, " \t\r\n", &save);
+            if (code == NULL) { failed = scene_error(path, lineno, "missing NACA code"); break; }
+            if (parse_floats(&save, values, 4) != 4 || !(values[0] > 0.0f)) {
+                failed = scene_error(path, lineno, "expected: naca NAME CODE CHORD X Y ANGLE");
+                break;
+            }
+            if (naca_profile(body, code, values[0])) { failed = scene_error(path, lineno, "bad NACA 4-digit code"); break; }
+            body->pos = (Vector2D){values[1], values[2]};
+            body->angle = values[3] * (float)M_PI / 180.0f;
+        } else if (strcmp(kind, "polygon") == 0) {
+            int n = parse_floats(&save, values, (int)(sizeof(values) / sizeof(values[0])));
+            if (n < 9 || (n - 3) % 2 != 0) {
+                failed = scene_error(path, lineno, "expected: polygon NAME X Y ANGLE X1 Y1 X2 Y2 X3 Y3 ...");
+                break;
+            }
+            body->num_vertices = (n - 3) / 2;
+            body->vertices = malloc(body->num_vertices * sizeof(Vector2D));
+            if (body->vertices == NULL) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+            for (int v = 0; v < body->num_vertices; v++)
+                body->vertices[v] = (Vector2D){values[3 + 2 * v], values[4 + 2 * v]};
+            body->pos = (Vector2D){values[0], values[1]};
+            body->angle = values[2] * (float)M_PI / 180.0f;
         } else {
-            if (p->vel.x < state->air_speed) p->vel.x += 0.02f;
+            failed = scene_error(path, lineno, "unknown body type (expected naca or polygon)");
+            break;
         }
+        scene->num_bodies++;
     }
+    fclose(f);
+
+    if (!failed && scene->num_bodies == 0) failed = scene_error(path, lineno, "no bodies in scene");
+    if (failed) scene_free(scene);
+    return failed;
 }
 
+void scene_free(Scene *scene) {
+    for (int b = 0; b < scene->num_bodies; b++) {
+        free(scene->bodies[b].vertices);
+        scene->bodies[b].vertices = NULL;
+    }
+    scene->num_bodies = 0;
+}
 
-// --- Drawing and UI ---
-void draw_shape(const Shape *object) {
-    attron(A_REVERSE);
-    float max_dim = fmax(object->size.x, object->size.y) * 1.5;
-    for (int y = object->pos.y - max_dim / 2; y < object->pos.y + max_dim / 2; y++) {
-        for (int x = object->pos.x - max_dim; x < object->pos.x + max_dim; x++) {
-            if (is_inside_shape(x, y, object)) mvaddch(y, x, ' ');
+// Loads a scene file and makes it the current object; the control angle starts at zero
+int use_scene(SimState *state, const char *path) {
+    if (scene_load(&state->scene, path)) return 1;
+    set_shape_type(state, SHAPE_SCENE);
+    state->object.angle = 0.0f;
+    state->obstacle.valid = 0;
+    return 0;
+}
+
+// --- Obstacle Grid ---
+static int same_shape(const Shape *a, const Shape *b) {
+    return a->type == b->type && a->pos.x == b->pos.x && a->pos.y == b->pos.y &&
+           a->size.x == b->size.x && a->size.y == b->size.y && a->angle == b->angle;
+}
+
+// Two-pass chamfer transform: distance from every cell to the nearest cell
+// whose occupancy differs from target (0 for cells that are not target).
+static void chamfer_distance(const unsigned char *solid, float *dist, int w, int h, unsigned char target) {
+    const float far = 1e9f, diag = 1.41421356f;
+    for (int i = 0; i < w * h; i++) dist[i] = solid[i] == target ? far : 0.0f;
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            float *d = &dist[y * w + x];
+            if (*d == 0.0f) continue;
+            if (x > 0) *d = fminf(*d, d[-1] + 1.0f);
+            if (y > 0) {
+                *d = fminf(*d, d[-w] + 1.0f);
+                if (x > 0) *d = fminf(*d, d[-w - 1] + diag);
+                if (x < w - 1) *d = fminf(*d, d[-w + 1] + diag);
+            }
+        }
+    }
+    for (int y = h - 1; y >= 0; y--) {
+        for (int x = w - 1; x >= 0; x--) {
+            float *d = &dist[y * w + x];
+            if (*d == 0.0f) continue;
+            if (x < w - 1) *d = fminf(*d, d[1] + 1.0f);
+            if (y < h - 1) {
+                *d = fminf(*d, d[w] + 1.0f);
+                if (x < w - 1) *d = fminf(*d, d[w + 1] + diag);
+                if (x > 0) *d = fminf(*d, d[w - 1] + diag);
+            }
         }
     }
-    attroff(A_REVERSE);
 }
 
-void draw_force_gauges(const SimState *state) {
-    int gauge_x = state->screen_width - 25;
-    int gauge_y = 5;
-    
-    // Note: In physics, positive Y is up. In ncurses, it's down.
-    // We calculate force so that positive force.y is UPWARD LIFT.
-    float lift = state->total_force.y;
-    float drag = state->total_force.x;
+// Sets the grid's placement and makes room for its cells
+static void obstacle_grid_resize(ObstacleGrid *grid, int x0, int y0, int width, int height) {
+    grid->x0 = x0;
+    grid->y0 = y0;
+    grid->width = width;
+    grid->height = height;
 
-    // Scale the forces to make the bars visible
-    float scale = 3.0f;
-    int lift_bar = (int)(lift * scale);
-    int drag_bar = (int)(drag * scale);
+    int cells = width * height;
+    if (cells > grid->capacity) {
+        free(grid->solid);
+        free(grid->body);
+        free(grid->sdf);
+        free(grid->normal);
+        grid->solid = malloc(cells);
+        grid->body = malloc(cells);
+        grid->sdf = malloc(cells * sizeof(float));
+        grid->normal = malloc(cells * sizeof(Vector2D));
+        if (grid->solid == NULL || grid->body == NULL || grid->sdf == NULL || grid->normal == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        grid->capacity = cells;
+    }
+    memset(grid->solid, 0, cells);
+    memset(grid->body, 0, cells);
+}
+
+// A polygon edge in screen coordinates, tagged with its body
+typedef struct {
+    float x0, y0, x1, y1;
+    int body;
+} SceneEdge;
+
+typedef struct {
+    float x;
+    int body;
+} Crossing;
+
+// Screen position of a body-space point: pitch nose-up by angle about the
+// body origin, then squash y for the terminal's cell aspect
+static Vector2D body_to_screen(const Body *b, float angle, Vector2D v) {
+    float c = cosf(angle), s = sinf(angle);
+    float rx = v.x * c + v.y * s, ry = -v.x * s + v.y * c;
+    return (Vector2D){b->pos.x + rx, b->pos.y - ry * SCENE_ASPECT};
+}
+
+// Scanline fill of every body. Edges are bucketed by the grid rows they span
+// (a counting sort into a uniform grid of rows), so each row only looks at the
+// edges that cross it and the cost grows with edges per row, not with
+// bodies x cells. Cells are sampled at integer coordinates like is_inside_shape.
+static void rasterize_scene(ObstacleGrid *grid, const Scene *scene, float control_angle) {
+    int num_edges = 0;
+    for (int b = 0; b < scene->num_bodies; b++) num_edges += scene->bodies[b].num_vertices;
+    SceneEdge *edges = malloc((num_edges + 1) * sizeof(SceneEdge));
+    if (edges == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+
+    float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    num_edges = 0;
+    for (int b = 0; b < scene->num_bodies; b++) {
+        const Body *body = &scene->bodies[b];
+        float angle = body->angle + (b == scene->num_bodies - 1 ? control_angle : 0.0f);
+        Vector2D prev = body_to_screen(body, angle, body->vertices[body->num_vertices - 1]);
+        for (int v = 0; v < body->num_vertices; v++) {
+            Vector2D cur = body_to_screen(body, angle, body->vertices[v]);
+            min_x = fminf(min_x, cur.x);
+            max_x = fmaxf(max_x, cur.x);
+            min_y = fminf(min_y, cur.y);
+            max_y = fmaxf(max_y, cur.y);
+            if (cur.y != prev.y) edges[num_edges++] = (SceneEdge){prev.x, prev.y, cur.x, cur.y, b};
+            prev = cur;
+        }
+    }
+    if (num_edges == 0) min_x = max_x = min_y = max_y = 0.0f;
+
+    // Two fluid cells of border around the bodies for the distance field
+    int x0 = (int)floorf(min_x) - 2, y0 = (int)floorf(min_y) - 2;
+    obstacle_grid_resize(grid, x0, y0, (int)ceilf(max_x) + 3 - x0, (int)ceilf(max_y) + 3 - y0);
+    int w = grid->width, h = grid->height;
+
+    // Rows an edge covers: sample y with min(y0, y1) <= y < max(y0, y1)
+    int *row_start = calloc(h + 1, sizeof(int));
+    int *first_row = malloc((num_edges + 1) * sizeof(int)), *last_row = malloc((num_edges + 1) * sizeof(int));
+    if (row_start == NULL || first_row == NULL || last_row == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    int total = 0;
+    for (int e = 0; e < num_edges; e++) {
+        first_row[e] = (int)ceilf(fminf(edges[e].y0, edges[e].y1)) - y0;
+        last_row[e] = (int)ceilf(fmaxf(edges[e].y0, edges[e].y1)) - 1 - y0;
+        for (int r = first_row[e]; r <= last_row[e]; r++) row_start[r + 1]++;
+        total += last_row[e] - first_row[e] + 1;
+    }
+    for (int r = 0; r < h; r++) row_start[r + 1] += row_start[r];
+    int *bucket = malloc((total + 1) * sizeof(int));
+    int *fill = malloc((h + 1) * sizeof(int));
+    Crossing *cross = malloc((num_edges + 1) * sizeof(Crossing));
+    if (bucket == NULL || fill == NULL || cross == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(fill, row_start, h * sizeof(int));
+    for (int e = 0; e < num_edges; e++) {
+        for (int r = first_row[e]; r <= last_row[e]; r++) bucket[fill[r]++] = e;
+    }
+
+    for (int r = 0; r < h; r++) {
+        float y = (float)(y0 + r);
+        int n = 0;
+        for (int k = row_start[r]; k < row_start[r + 1]; k++) {
+            const SceneEdge *e = &edges[bucket[k]];
+            float t = (y - e->y0) / (e->y1 - e->y0);
+            cross[n++] = (Crossing){e->x0 + t * (e->x1 - e->x0), e->body};
+        }
+        // Few crossings per row: insertion sort by body, then x
+        for (int i = 1; i < n; i++) {
+            Crossing c = cross[i];
+            int j = i - 1;
+            while (j >= 0 && (cross[j].body > c.body || (cross[j].body == c.body && cross[j].x > c.x))) {
+                cross[j + 1] = cross[j];
+                j--;
+            }
+            cross[j + 1] = c;
+        }
+        // Even-odd rule per body: cells with x in [enter, leave) are inside
+        for (int i = 0; i + 1 < n; i += 2) {
+            if (cross[i].body != cross[i + 1].body) {
+                i--; // Odd crossing count for a body (degenerate edge): resync on the next one
+                continue;
+            }
+            int gx_begin = (int)ceilf(cross[i].x) - x0, gx_end = (int)ceilf(cross[i + 1].x) - x0;
+            if (gx_begin < 0) gx_begin = 0;
+            if (gx_end > w) gx_end = w;
+            for (int gx = gx_begin; gx < gx_end; gx++) {
+                grid->solid[r * w + gx] = 1;
+                grid->body[r * w + gx] = (unsigned char)cross[i].body;
+            }
+        }
+    }
+
+    free(edges);
+    free(row_start);
+    free(first_row);
+    free(last_row);
+    free(bucket);
+    free(fill);
+    free(cross);
+}
+
+// Rasterizes the object (or the scene's bodies) if it changed since the last call
+void obstacle_grid_update(ObstacleGrid *grid, const Shape *object, const Scene *scene) {
+    if (grid->valid && same_shape(&grid->key, object)) return;
+
+    if (object->type == SHAPE_SCENE) {
+        rasterize_scene(grid, scene, object->angle);
+    } else {
+        // Every shape fits in its half-diagonal; the extra cells keep a fluid border
+        // around the object for the distance field
+        int r = (int)ceilf(hypotf(object->size.x, object->size.y) / 2.0f) + 2;
+        obstacle_grid_resize(grid, (int)floorf(object->pos.x) - r, (int)floorf(object->pos.y) - r, 2 * r + 2, 2 * r + 2);
+        for (int y = 0; y < grid->height; y++)
+            for (int x = 0; x < grid->width; x++)
+                grid->solid[y * grid->width + x] = (unsigned char)is_inside_shape(grid->x0 + x, grid->y0 + y, object);
+    }
+
+    int w = grid->width, h = grid->height, cells = w * h;
+
+    // Signed distance: outside cells measure to the object, inside cells to the fluid.
+    // The normal buffer doubles as scratch space for the second transform.
+    float *inside = (float *)grid->normal;
+    chamfer_distance(grid->solid, grid->sdf, w, h, 0);
+    chamfer_distance(grid->solid, inside, w, h, 1);
+    for (int i = 0; i < cells; i++) {
+        grid->sdf[i] = grid->solid[i] ? 0.5f - inside[i] : grid->sdf[i] - 0.5f;
+    }
+
+    // Outward normal = normalised SDF gradient
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            const float *d = &grid->sdf[y * w + x];
+            float gx = (x < w - 1 ? d[1] : d[0]) - (x > 0 ? d[-1] : d[0]);
+            float gy = (y < h - 1 ? d[w] : d[0]) - (y > 0 ? d[-w] : d[0]);
+            float len = sqrtf(gx * gx + gy * gy);
+            grid->normal[y * w + x] = len > 1e-6f ? (Vector2D){gx / len, gy / len} : (Vector2D){-1, 0};
+        }
+    }
+
+    grid->key = *object;
+    grid->valid = 1;
+    grid->version++;
+}
+
+// Grid index of screen cell (x, y), or -1 if it lies outside the grid
+static inline int obstacle_cell(const ObstacleGrid *grid, int x, int y) {
+    unsigned int gx = (unsigned int)(x - grid->x0);
+    unsigned int gy = (unsigned int)(y - grid->y0);
+    if (gx >= (unsigned int)grid->width || gy >= (unsigned int)grid->height) return -1;
+    return (int)gy * grid->width + (int)gx;
+}
+
+// Grid index if pos rounds to a solid cell, otherwise -1
+static inline int obstacle_solid_cell(const ObstacleGrid *grid, Vector2D pos) {
+    int cell = obstacle_cell(grid, (int)roundf(pos.x), (int)roundf(pos.y));
+    return cell >= 0 && grid->solid[cell] ? cell : -1;
+}
+
+void obstacle_grid_free(ObstacleGrid *grid) {
+    free(grid->solid);
+    free(grid->body);
+    free(grid->sdf);
+    free(grid->normal);
+    grid->solid = NULL;
+    grid->body = NULL;
+    grid->sdf = NULL;
+    grid->normal = NULL;
+    grid->capacity = 0;
+    grid->valid = 0;
+}
+
+// Reflects the velocity off a surface; the sign of the normal does not matter
+void handle_particle_collision(Vector2D *vel, Vector2D normal) {
+    float restitution = 0.4f, friction = 0.8f;
+    float vel_dot_normal = vel->x * normal.x + vel->y * normal.y;
+    Vector2D normal_vel = {normal.x * vel_dot_normal, normal.y * vel_dot_normal};
+    Vector2D tangent_vel = {vel->x - normal_vel.x, vel->y - normal_vel.y};
+    vel->x = (tangent_vel.x * friction) - (normal_vel.x * restitution);
+    vel->y = (tangent_vel.y * friction) - (normal_vel.y * restitution);
+}
+
+// Region in which a particle can take the free-stream path: inside the domain
+// and outside a conservative box around the object.
+typedef struct {
+    float width, height;
+    float box_x0, box_x1, box_y0, box_y1;
+    float air_speed;
+    float dt;
+} FreeStreamBounds;
+
+static FreeStreamBounds free_stream_bounds(const SimState *state) {
+    // Positions that round into the obstacle grid, widened by one cell
+    const ObstacleGrid *grid = &state->obstacle;
+    FreeStreamBounds b;
+    b.width = (float)state->screen_width;
+    b.height = (float)state->screen_height;
+    b.box_x0 = (float)grid->x0 - 1.0f;
+    b.box_x1 = (float)(grid->x0 + grid->width);
+    b.box_y0 = (float)grid->y0 - 1.0f;
+    b.box_y1 = (float)(grid->y0 + grid->height);
+    b.air_speed = state->air_speed;
+    b.dt = state->time_step;
+    return b;
+}
+
+// Advects particles [begin, end) that stay in free stream and appends the rest
+// (left the domain, or whose step overlaps the box around the object) to
+// slow_list untouched. The overlap test uses the bounding box of the whole
+// step, so a long step cannot jump over the object. Returns the
+// number of slow particles. Every lane does exactly what the scalar path does,
+// so results do not depend on which kernel was compiled in (given
+// -ffp-contract=off, see the build line at the top).
+static int advect_free_stream(ParticleArrays *p, int begin, int end, const FreeStreamBounds *b, int *slow_list) {
+    int num_slow = 0;
+    int i = begin;
+
+#if defined(__AVX__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 width = _mm256_set1_ps(b->width), height = _mm256_set1_ps(b->height);
+    const __m256 bx0 = _mm256_set1_ps(b->box_x0), bx1 = _mm256_set1_ps(b->box_x1);
+    const __m256 by0 = _mm256_set1_ps(b->box_y0), by1 = _mm256_set1_ps(b->box_y1);
+    const __m256 speed = _mm256_set1_ps(b->air_speed), accel = _mm256_set1_ps(0.02f * b->dt);
+    const __m256 dt = _mm256_set1_ps(b->dt);
+    for (; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_loadu_ps(&p->x[i]), y = _mm256_loadu_ps(&p->y[i]);
+        __m256 vx = _mm256_loadu_ps(&p->vx[i]), vy = _mm256_loadu_ps(&p->vy[i]);
+        __m256 nx = _mm256_add_ps(x, _mm256_mul_ps(vx, dt)), ny = _mm256_add_ps(y, _mm256_mul_ps(vy, dt));
+
+        __m256 out = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(nx, width, _CMP_GE_OQ), _mm256_cmp_ps(nx, zero, _CMP_LT_OQ)),
+                                  _mm256_or_ps(_mm256_cmp_ps(ny, height, _CMP_GE_OQ), _mm256_cmp_ps(ny, zero, _CMP_LT_OQ)));
+        __m256 near = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(_mm256_max_ps(x, nx), bx0, _CMP_GT_OQ),
+                                                  _mm256_cmp_ps(_mm256_min_ps(x, nx), bx1, _CMP_LT_OQ)),
+                                    _mm256_and_ps(_mm256_cmp_ps(_mm256_max_ps(y, ny), by0, _CMP_GT_OQ),
+                                                  _mm256_cmp_ps(_mm256_min_ps(y, ny), by1, _CMP_LT_OQ)));
+        __m256 slow = _mm256_or_ps(out, near);
+        __m256 nvx = _mm256_add_ps(vx, _mm256_and_ps(_mm256_cmp_ps(vx, speed, _CMP_LT_OQ), accel));
+
+        _mm256_storeu_ps(&p->x[i], _mm256_blendv_ps(nx, x, slow));
+        _mm256_storeu_ps(&p->y[i], _mm256_blendv_ps(ny, y, slow));
+        _mm256_storeu_ps(&p->vx[i], _mm256_blendv_ps(nvx, vx, slow));
+
+        int mask = _mm256_movemask_ps(slow);
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            slow_list[num_slow++] = i + lane;
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 width = _mm_set1_ps(b->width), height = _mm_set1_ps(b->height);
+    const __m128 bx0 = _mm_set1_ps(b->box_x0), bx1 = _mm_set1_ps(b->box_x1);
+    const __m128 by0 = _mm_set1_ps(b->box_y0), by1 = _mm_set1_ps(b->box_y1);
+    const __m128 speed = _mm_set1_ps(b->air_speed), accel = _mm_set1_ps(0.02f * b->dt);
+    const __m128 dt = _mm_set1_ps(b->dt);
+    for (; i + 4 <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(&p->x[i]), y = _mm_loadu_ps(&p->y[i]);
+        __m128 vx = _mm_loadu_ps(&p->vx[i]), vy = _mm_loadu_ps(&p->vy[i]);
+        __m128 nx = _mm_add_ps(x, _mm_mul_ps(vx, dt)), ny = _mm_add_ps(y, _mm_mul_ps(vy, dt));
+
+        __m128 out = _mm_or_ps(_mm_or_ps(_mm_cmpge_ps(nx, width), _mm_cmplt_ps(nx, zero)),
+                               _mm_or_ps(_mm_cmpge_ps(ny, height), _mm_cmplt_ps(ny, zero)));
+        __m128 near = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(_mm_max_ps(x, nx), bx0), _mm_cmplt_ps(_mm_min_ps(x, nx), bx1)),
+                                 _mm_and_ps(_mm_cmpgt_ps(_mm_max_ps(y, ny), by0), _mm_cmplt_ps(_mm_min_ps(y, ny), by1)));
+        __m128 slow = _mm_or_ps(out, near);
+        __m128 nvx = _mm_add_ps(vx, _mm_and_ps(_mm_cmplt_ps(vx, speed), accel));
+
+        // SSE2 has no blendv: select with and/andnot/or
+        _mm_storeu_ps(&p->x[i], _mm_or_ps(_mm_and_ps(slow, x), _mm_andnot_ps(slow, nx)));
+        _mm_storeu_ps(&p->y[i], _mm_or_ps(_mm_and_ps(slow, y), _mm_andnot_ps(slow, ny)));
+        _mm_storeu_ps(&p->vx[i], _mm_or_ps(_mm_and_ps(slow, vx), _mm_andnot_ps(slow, nvx)));
+
+        int mask = _mm_movemask_ps(slow);
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            slow_list[num_slow++] = i + lane;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // Scalar fallback and tail
+    for (; i < end; i++) {
+        float x = p->x[i], y = p->y[i];
+        float nx = x + p->vx[i] * b->dt;
+        float ny = y + p->vy[i] * b->dt;
+        int out = nx >= b->width || nx < 0 || ny >= b->height || ny < 0;
+        int near = fmaxf(x, nx) > b->box_x0 && fminf(x, nx) < b->box_x1 &&
+                   fmaxf(y, ny) > b->box_y0 && fminf(y, ny) < b->box_y1;
+        if (out || near) {
+            slow_list[num_slow++] = i;
+            continue;
+        }
+        p->x[i] = nx;
+        p->y[i] = ny;
+        if (p->vx[i] < b->air_speed) p->vx[i] += 0.02f * b->dt;
+    }
+    return num_slow;
+}
+
+// Walks the grid cells crossed by the segment a -> a + d (cells are centred on
+// integer coordinates, matching the rounding used for lookups) and returns the
+// first solid one, or -1. *t_hit is the segment parameter where it is entered
+// and *face the outward normal of the cell face the segment came through.
+static int obstacle_sweep(const ObstacleGrid *grid, Vector2D a, Vector2D d, float *t_hit, Vector2D *face) {
+    int cx = (int)roundf(a.x), cy = (int)roundf(a.y);
+    int steps = abs((int)roundf(a.x + d.x) - cx) + abs((int)roundf(a.y + d.y) - cy);
+    int step_x = d.x > 0 ? 1 : -1, step_y = d.y > 0 ? 1 : -1;
+    float t_max_x = d.x != 0 ? (cx + 0.5f * step_x - a.x) / d.x : INFINITY;
+    float t_max_y = d.y != 0 ? (cy + 0.5f * step_y - a.y) / d.y : INFINITY;
+    float t_delta_x = d.x != 0 ? 1.0f / fabsf(d.x) : INFINITY;
+    float t_delta_y = d.y != 0 ? 1.0f / fabsf(d.y) : INFINITY;
+
+    float t = 0.0f;
+    Vector2D entered = {-d.x, -d.y};
+    for (int k = 0; ; k++) {
+        int cell = obstacle_cell(grid, cx, cy);
+        if (cell >= 0 && grid->solid[cell]) {
+            *t_hit = t;
+            *face = entered;
+            return cell;
+        }
+        if (k == steps) return -1;
+        if (t_max_x < t_max_y) {
+            cx += step_x;
+            t = t_max_x;
+            t_max_x += t_delta_x;
+            entered = (Vector2D){(float)-step_x, 0};
+        } else {
+            cy += step_y;
+            t = t_max_y;
+            t_max_y += t_delta_y;
+            entered = (Vector2D){0, (float)-step_y};
+        }
+    }
+}
+
+// Point just before parameter t on a -> a + d, backed off by a hundredth of a
+// cell so it rounds to the fluid cell in front of the surface
+static Vector2D sweep_point(Vector2D a, Vector2D d, float t) {
+    float len = sqrtf(d.x * d.x + d.y * d.y);
+    float back = len > 0.0f ? t - 0.01f / len : 0.0f;
+    if (back < 0.0f) back = 0.0f;
+    return (Vector2D){a.x + d.x * back, a.y + d.y * back};
+}
+
+// Full per-particle update for particles the kernel could not take. The step
+// is swept through the obstacle grid, so a particle stops at the first solid
+// cell on its path however long the step is; it reflects off the cached normal
+// and spends the rest of the step on the new velocity. Returns 1 if the
+// particle left the domain; the caller reinjects those in a batch.
+static int update_particle_slow(SimState *state, int i, WorkerSlot *slot) {
+    ParticleArrays *p = &state->particles;
+    const ObstacleGrid *grid = &state->obstacle;
+    float dt = state->time_step;
+    Vector2D last_pos = {p->x[i], p->y[i]};
+    Vector2D vel = {p->vx[i], p->vy[i]};
+    Vector2D vel_before = vel;
+    Vector2D pos, face;
+    float t_hit;
+    int cell;
+
+    if ((cell = obstacle_solid_cell(grid, last_pos)) >= 0) {
+        // Spawned inside, or the object moved onto it: push it out along the
+        // normal instead of letting it collide from the inside every step
+        float depth = 1.0f - grid->sdf[cell];
+        pos.x = last_pos.x + grid->normal[cell].x * depth;
+        pos.y = last_pos.y + grid->normal[cell].y * depth;
+    } else if ((cell = obstacle_sweep(grid, last_pos, (Vector2D){vel.x * dt, vel.y * dt}, &t_hit, &face)) >= 0) {
+        Vector2D hit = sweep_point(last_pos, (Vector2D){vel.x * dt, vel.y * dt}, t_hit);
+        handle_particle_collision(&vel, grid->normal[cell]);
+        float into_face = vel.x * face.x + vel.y * face.y;
+        if (into_face < 0) {
+            // On the staircase of a rasterized slope the smooth normal can send the
+            // particle back into the cell face it came through; slide along that face
+            vel.x -= face.x * into_face;
+            vel.y -= face.y * into_face;
+        }
+        
+        // --- ACCUMULATE FORCES ---
+        // The force on the object is the opposite of the change in the particle's momentum
+        slot->force.x += vel_before.x - vel.x; // Drag
+        slot->force.y += vel_before.y - vel.y; // Lift
+        slot->body_force[grid->body[cell]].x += vel_before.x - vel.x;
+        slot->body_force[grid->body[cell]].y += vel_before.y - vel.y;
+        
+        // Rest of the step after the bounce, stopping short of the surface if it hits again
+        Vector2D rest = {vel.x * dt * (1.0f - t_hit), vel.y * dt * (1.0f - t_hit)};
+        float t_again;
+        if (obstacle_sweep(grid, hit, rest, &t_again, &face) >= 0) pos = sweep_point(hit, rest, t_again);
+        else pos = (Vector2D){hit.x + rest.x, hit.y + rest.y};
+    } else {
+        pos = (Vector2D){last_pos.x + vel.x * dt, last_pos.y + vel.y * dt};
+        if (vel.x < state->air_speed) vel.x += 0.02f * dt;
+    }
+
+    if (pos.x >= state->screen_width || pos.x < 0 || pos.y >= state->screen_height || pos.y < 0) return 1;
+
+    p->x[i] = pos.x;
+    p->y[i] = pos.y;
+    p->vx[i] = vel.x;
+    p->vy[i] = vel.y;
+    return 0;
+}
+
+typedef struct {
+    SimState *state;
+    FreeStreamBounds bounds;
+} StepTask;
+
+static void step_worker(void *ctx, int worker, int num_workers) {
+    StepTask *task = ctx;
+    SimState *state = task->state;
+    WorkerSlot *slot = &state->workers[worker];
+    int begin, end;
+    worker_range(state->num_particles, worker, num_workers, 8, &begin, &end);
+
+    // Fast path: SIMD advection of every free-stream particle.
+    // Slow indices of this range go into the matching part of slow_list.
+    int *slow_list = state->particles.slow_list + begin;
+    int num_slow = advect_free_stream(&state->particles, begin, end, &task->bounds, slow_list);
+
+    // Slow path in index order. Exits are compacted to the front of the list
+    // and reinjected in one batch from the worker's stream.
+    slot->force = (Vector2D){0, 0};
+    memset(slot->body_force, 0, sizeof(slot->body_force));
+    int num_exit = 0;
+    for (int k = 0; k < num_slow; k++) {
+        if (update_particle_slow(state, slow_list[k], slot)) slow_list[num_exit++] = slow_list[k];
+    }
+    reinject_particles(state, slow_list, num_exit, &slot->rng);
+}
+
+static void force_stats_update(SimState *state);
+
+// Reduce in worker order so the sum is the same on every run
+static Vector2D reduce_worker_forces(const SimState *state) {
+    Vector2D total = {0, 0};
+    for (int t = 0; t < state->pool->num_threads; t++) {
+        total.x += state->workers[t].force.x;
+        total.y += state->workers[t].force.y;
+    }
+    return total;
+}
+
+// Per-body forces of this step, reduced the same way and scaled to force units
+static void reduce_body_forces(SimState *state, float scale) {
+    for (int b = 0; b < MAX_BODIES; b++) {
+        Vector2D total = {0, 0};
+        for (int t = 0; t < state->pool->num_threads; t++) {
+            total.x += state->workers[t].body_force[b].x;
+            total.y += state->workers[t].body_force[b].y;
+        }
+        state->body_force[b] = (Vector2D){total.x * scale, total.y * scale};
+    }
+}
+
+void update_simulation(SimState *state) {
+    obstacle_grid_update(&state->obstacle, &state->object, &state->scene);
+
+    if (state->engine == ENGINE_LBM) {
+        lattice_step(state);
+    } else {
+        StepTask task = {state, free_stream_bounds(state)};
+        pool_run(state->pool, step_worker, &task);
+        // Impulse per step -> force, so the readout does not depend on the step size
+        Vector2D impulse = reduce_worker_forces(state); // Reset forces each frame
+        state->total_force = (Vector2D){impulse.x / state->time_step, impulse.y / state->time_step};
+        reduce_body_forces(state, 1.0f / state->time_step);
+        if (state->collisions) collide_particles(state);
+    }
+    force_stats_update(state);
+    if (state->recorder) record_step(state->recorder, state);
+}
+
+
+// --- Particle-Particle Collisions ---
+void collision_grid_free(CollisionGrid *cg) {
+    free(cg->cell_start);
+    free(cg->offsets);
+    free(cg->x);
+    free(cg->y);
+    free(cg->vx);
+    free(cg->vy);
+    *cg = (CollisionGrid){0};
+}
+
+// Sizes the cell grid for the domain and the scatter arrays to match the particle pool
+static void collision_grid_prepare(CollisionGrid *cg, const SimState *state) {
+    int cells_x = (state->screen_width + DSMC_CELL - 1) / DSMC_CELL;
+    int cells_y = (state->screen_height + DSMC_CELL - 1) / DSMC_CELL;
+    int workers = state->pool->num_threads;
+    if (cells_x != cg->cells_x || cells_y != cg->cells_y || workers != cg->num_workers) {
+        free(cg->cell_start);
+        free(cg->offsets);
+        size_t cells = (size_t)cells_x * cells_y;
+        cg->cell_start = malloc((cells + 1) * sizeof(int));
+        cg->offsets = malloc(cells * workers * sizeof(int));
+        if (cg->cell_start == NULL || cg->offsets == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        cg->cells_x = cells_x;
+        cg->cells_y = cells_y;
+        cg->num_workers = workers;
+    }
+    // The arrays are swapped with the particle arrays, so both must have the pool's capacity
+    if (cg->capacity != state->particles.capacity) {
+        float **arrays[4] = {&cg->x, &cg->y, &cg->vx, &cg->vy};
+        for (int a = 0; a < 4; a++) {
+            free(*arrays[a]);
+            *arrays[a] = alloc_particle_array(state->particles.capacity, sizeof(float));
+        }
+        cg->capacity = state->particles.capacity;
+    }
+}
+
+static inline int collision_cell(const CollisionGrid *cg, float x, float y) {
+    int cx = (int)x / DSMC_CELL, cy = (int)y / DSMC_CELL;
+    if (cx < 0) cx = 0;
+    if (cx >= cg->cells_x) cx = cg->cells_x - 1;
+    if (cy < 0) cy = 0;
+    if (cy >= cg->cells_y) cy = cg->cells_y - 1;
+    return cy * cg->cells_x + cx;
+}
+
+typedef struct {
+    SimState *state;
+    int phase;
+} CollisionTask;
+
+enum { SORT_HISTOGRAM, SORT_LOCAL_PREFIX, SORT_GLOBAL_OFFSETS, SORT_SCATTER, PAIR_COLLIDE };
+
+// Elastic equal-mass collision: the relative velocity keeps its magnitude and
+// gets a random direction, so momentum and energy are conserved
+static void collide_pair(ParticleArrays *p, int a, int b, Rng *rng) {
+    float gx = p->vx[a] - p->vx[b], gy = p->vy[a] - p->vy[b];
+    float g = sqrtf(gx * gx + gy * gy);
+    float prob = g / DSMC_REL_SPEED;
+    if (prob < 1.0f && rng_float(rng) >= prob) return;
+
+    float cmx = 0.5f * (p->vx[a] + p->vx[b]), cmy = 0.5f * (p->vy[a] + p->vy[b]);
+    float theta = rng_float(rng) * 2.0f * (float)M_PI;
+    float hx = 0.5f * g * cosf(theta), hy = 0.5f * g * sinf(theta);
+    p->vx[a] = cmx + hx;
+    p->vy[a] = cmy + hy;
+    p->vx[b] = cmx - hx;
+    p->vy[b] = cmy - hy;
+}
+
+// One phase of the sort/collide pipeline. Particles are split by index range
+// and cells by cell range; offsets are laid out cell-major, worker-minor, so
+// the sort is stable and does not depend on thread timing.
+static void collision_worker(void *ctx, int worker, int num_workers) {
+    CollisionTask *task = ctx;
+    SimState *state = task->state;
+    CollisionGrid *cg = &state->collision_grid;
+    ParticleArrays *p = &state->particles;
+    int cells = cg->cells_x * cg->cells_y;
+    int *offsets = cg->offsets + (size_t)worker * cells;
+    int begin, end, c_begin, c_end;
+    worker_range(state->num_particles, worker, num_workers, 8, &begin, &end);
+    worker_range(cells, worker, num_workers, 1, &c_begin, &c_end);
+
+    switch (task->phase) {
+        case SORT_HISTOGRAM:
+            memset(offsets, 0, cells * sizeof(int));
+            for (int i = begin; i < end; i++) offsets[collision_cell(cg, p->x[i], p->y[i])]++;
+            break;
+
+        case SORT_LOCAL_PREFIX: {
+            int running = 0;
+            for (int c = c_begin; c < c_end; c++) {
+                for (int w = 0; w < num_workers; w++) {
+                    int *slot = &cg->offsets[(size_t)w * cells + c];
+                    int count = *slot;
+                    *slot = running;
+                    running += count;
+                }
+            }
+            cg->range_total[worker] = running;
+            break;
+        }
+
+        case SORT_GLOBAL_OFFSETS: {
+            int base = 0;
+            for (int w = 0; w < worker; w++) base += cg->range_total[w];
+            for (int c = c_begin; c < c_end; c++) {
+                for (int w = 0; w < num_workers; w++) cg->offsets[(size_t)w * cells + c] += base;
+                cg->cell_start[c] = cg->offsets[c];
+            }
+            break;
+        }
+
+        case SORT_SCATTER:
+            for (int i = begin; i < end; i++) {
+                int dst = offsets[collision_cell(cg, p->x[i], p->y[i])]++;
+                cg->x[dst] = p->x[i];
+                cg->y[dst] = p->y[i];
+                cg->vx[dst] = p->vx[i];
+                cg->vy[dst] = p->vy[i];
+            }
+            break;
+
+        case PAIR_COLLIDE: {
+            Rng *rng = &state->workers[worker].rng;
+            // Collisions per unit time stay the same whatever --dt is
+            float pair_rate = DSMC_PAIR_FRACTION * state->time_step;
+            for (int c = c_begin; c < c_end; c++) {
+                int first = cg->cell_start[c];
+                int n = cg->cell_start[c + 1] - first;
+                if (n < 2) continue;
+                int pairs = (int)(pair_rate * n + rng_float(rng));
+                for (int k = 0; k < pairs; k++) {
+                    int a = rng_below(rng, n);
+                    int b = rng_below(rng, n - 1);
+                    if (b >= a) b++;
+                    collide_pair(p, first + a, first + b, rng);
+                }
+            }
+            break;
+        }
+    }
+}
+
+// Bins particles into collision cells with a parallel counting sort, leaves
+// them in cell order, then collides random pairs within each cell
+void collide_particles(SimState *state) {
+    CollisionGrid *cg = &state->collision_grid;
+    collision_grid_prepare(cg, state);
+
+    CollisionTask task = {state, SORT_HISTOGRAM};
+    pool_run(state->pool, collision_worker, &task);
+    task.phase = SORT_LOCAL_PREFIX;
+    pool_run(state->pool, collision_worker, &task);
+    task.phase = SORT_GLOBAL_OFFSETS;
+    pool_run(state->pool, collision_worker, &task);
+    cg->cell_start[cg->cells_x * cg->cells_y] = state->num_particles;
+    task.phase = SORT_SCATTER;
+    pool_run(state->pool, collision_worker, &task);
+
+    ParticleArrays *p = &state->particles;
+    float *tmp;
+    tmp = p->x; p->x = cg->x; cg->x = tmp;
+    tmp = p->y; p->y = cg->y; cg->y = tmp;
+    tmp = p->vx; p->vx = cg->vx; cg->vx = tmp;
+    tmp = p->vy; p->vy = cg->vy; cg->vy = tmp;
+
+    task.phase = PAIR_COLLIDE;
+    pool_run(state->pool, collision_worker, &task);
+}
+
+
+// --- Force Statistics ---
+static void stat_reset(RunningStat *st) {
+    memset(st, 0, sizeof(*st));
+    st->batch_size = 1;
+}
+
+static void stat_push(RunningStat *st, double x) {
+    st->ema = st->count == 0 ? x : st->ema + STATS_EMA_ALPHA * (x - st->ema);
+    st->count++;
+    double delta = x - st->mean;
+    st->mean += delta / st->count;
+    st->m2 += delta * (x - st->mean);
+
+    st->batch_sum += x;
+    if (++st->batch_fill < st->batch_size) return;
+    st->batches[st->num_batches++] = st->batch_sum / st->batch_size;
+    st->batch_sum = 0.0;
+    st->batch_fill = 0;
+    if (st->num_batches == 2 * STATS_MAX_BATCHES) {
+        for (int b = 0; b < STATS_MAX_BATCHES; b++) {
+            st->batches[b] = 0.5 * (st->batches[2 * b] + st->batches[2 * b + 1]);
+        }
+        st->num_batches = STATS_MAX_BATCHES;
+        st->batch_size *= 2;
+    }
+}
+
+// Per-step sample variance (ignores correlation between steps)
+double stat_variance(const RunningStat *st) {
+    return st->count > 1 ? st->m2 / (st->count - 1) : 0.0;
+}
+
+// Autocorrelation-corrected standard error of the mean (batch-means estimate).
+// Correlation left between neighbouring batches inflates the error by the
+// AR(1) factor (1 + r1) / (1 - r1).
+double stat_std_error(const RunningStat *st) {
+    int n = st->num_batches;
+    if (n < 2) return INFINITY;
+    double mean = 0.0, var = 0.0, cov = 0.0;
+    for (int b = 0; b < n; b++) mean += st->batches[b];
+    mean /= n;
+    for (int b = 0; b < n; b++) var += (st->batches[b] - mean) * (st->batches[b] - mean);
+    for (int b = 1; b < n; b++) cov += (st->batches[b] - mean) * (st->batches[b - 1] - mean);
+    if (var <= 0.0) return 0.0;
+    double r1 = cov / var;
+    if (r1 < 0.0) r1 = 0.0;
+    if (r1 > 0.99) r1 = 0.99;
+    return sqrt(var / (n - 1) / n * (1.0 + r1) / (1.0 - r1));
+}
+
+void force_stats_reset(ForceStats *fs) {
+    stat_reset(&fs->lift);
+    stat_reset(&fs->drag);
+    fs->body_samples = 0;
+    memset(fs->body_lift_sum, 0, sizeof(fs->body_lift_sum));
+    memset(fs->body_drag_sum, 0, sizeof(fs->body_drag_sum));
+}
+
+// Largest standard error of lift and drag relative to the mean force magnitude.
+// Measured against the force vector so a near-zero lift can still converge.
+double force_stats_rel_error(const ForceStats *fs) {
+    if (fs->lift.num_batches < STATS_MIN_BATCHES || fs->lift.count < STATS_MIN_SAMPLES) return INFINITY;
+    double magnitude = hypot(fs->lift.mean, fs->drag.mean);
+    if (magnitude <= 0.0) return INFINITY;
+    return fmax(stat_std_error(&fs->lift), stat_std_error(&fs->drag)) / magnitude;
+}
+
+// Adds this step's forces, restarting the statistics whenever the object,
+// speed, density or engine changed since the previous sample
+static void force_stats_update(SimState *state) {
+    ForceStats *fs = &state->stats;
+    if (fs->obstacle_version != state->obstacle.version || fs->air_speed != state->air_speed ||
+        fs->air_density != state->air_density || fs->engine != (int)state->engine) {
+        force_stats_reset(fs);
+        fs->obstacle_version = state->obstacle.version;
+        fs->air_speed = state->air_speed;
+        fs->air_density = state->air_density;
+        fs->engine = (int)state->engine;
+    }
+    stat_push(&fs->lift, state->total_force.y);
+    stat_push(&fs->drag, state->total_force.x);
+
+    fs->num_bodies = state->object.type == SHAPE_SCENE ? state->scene.num_bodies : 1;
+    for (int b = 0; b < fs->num_bodies; b++) {
+        float lift = state->body_force[b].y, drag = state->body_force[b].x;
+        fs->body_lift_sum[b] += lift;
+        fs->body_drag_sum[b] += drag;
+        fs->body_lift_ema[b] = fs->body_samples ? fs->body_lift_ema[b] + (float)STATS_EMA_ALPHA * (lift - fs->body_lift_ema[b]) : lift;
+        fs->body_drag_ema[b] = fs->body_samples ? fs->body_drag_ema[b] + (float)STATS_EMA_ALPHA * (drag - fs->body_drag_ema[b]) : drag;
+    }
+    fs->body_samples++;
+}
+
+
+// --- Lattice-Boltzmann Engine ---
+static const int lbm_cx[9] = {0, 1, 0, -1, 0, 1, -1, -1, 1};
+static const int lbm_cy[9] = {0, 0, 1, 0, -1, 1, 1, -1, -1};
+static const int lbm_opp[9] = {0, 3, 4, 1, 2, 7, 8, 5, 6};
+static const float lbm_w[9] = {4.0f / 9, 1.0f / 9, 1.0f / 9, 1.0f / 9, 1.0f / 9,
+                               1.0f / 36, 1.0f / 36, 1.0f / 36, 1.0f / 36};
+
+static inline float lattice_equilibrium(int q, float rho, float ux, float uy) {
+    float cu = lbm_cx[q] * ux + lbm_cy[q] * uy;
+    return lbm_w[q] * rho * (1.0f + 3.0f * cu + 4.5f * cu * cu - 1.5f * (ux * ux + uy * uy));
+}
+
+static void lattice_set_equilibrium(float *f, int cells, int idx, float ux, float uy) {
+    for (int q = 0; q < 9; q++) f[q * cells + idx] = lattice_equilibrium(q, 1.0f, ux, uy);
+}
+
+void lattice_free(Lattice *lat) {
+    free(lat->f[0]);
+    free(lat->f[1]);
+    free(lat->solid);
+    *lat = (Lattice){0};
+}
+
+// Allocates the lattice for the current domain and fills it with uniform inflow
+static void lattice_init(Lattice *lat, int width, int height, float inlet_u) {
+    lattice_free(lat);
+    int cells = width * height;
+    lat->width = width;
+    lat->height = height;
+    lat->f[0] = alloc_particle_array((size_t)cells * 9, sizeof(float));
+    lat->f[1] = alloc_particle_array((size_t)cells * 9, sizeof(float));
+    lat->solid = calloc(cells, 1);
+    if (lat->solid == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < cells; i++) {
+        lattice_set_equilibrium(lat->f[0], cells, i, inlet_u, 0.0f);
+        lattice_set_equilibrium(lat->f[1], cells, i, inlet_u, 0.0f);
+    }
+    lat->cur = 0;
+    lat->obstacle_version = 0;
+}
+
+// Copies the rasterized obstacle into the lattice mask (body id + 1, so 0 is
+// fluid). Cells the object no longer covers restart from the inflow equilibrium.
+static void lattice_sync_obstacle(Lattice *lat, const ObstacleGrid *grid, float inlet_u) {
+    if (lat->obstacle_version == grid->version) return;
+    int w = lat->width, cells = w * lat->height;
+    for (int i = 0; i < cells; i++) {
+        if (lat->solid[i]) {
+            lat->solid[i] = 0;
+            lattice_set_equilibrium(lat->f[lat->cur], cells, i, inlet_u, 0.0f);
+        }
+    }
+    for (int gy = 0; gy < grid->height; gy++) {
+        int y = grid->y0 + gy;
+        if (y < 0 || y >= lat->height) continue;
+        for (int gx = 0; gx < grid->width; gx++) {
+            int x = grid->x0 + gx;
+            if (x < 1 || x >= w) continue; // Column 0 is the inlet
+            int cell = gy * grid->width + gx;
+            lat->solid[y * w + x] = grid->solid[cell] ? (unsigned char)(grid->body[cell] + 1) : 0;
+        }
+    }
+    lat->obstacle_version = grid->version;
+}
+
+typedef struct {
+    Lattice *lat;
+    WorkerSlot *workers;
+    float inlet_u;
+    float omega; // 1 / tau
+} LatticeTask;
+
+// Fused pull-stream + BGK collide over a band of rows. Links that pull from a
+// solid cell are bounced back, and each bounce adds 2 f c to the force on the
+// body (momentum exchange). Column 0 is a fixed inflow, the last column pulls
+// from itself (zero-gradient outflow), and the top and bottom wrap.
+static void lattice_worker(void *ctx, int worker, int num_workers) {
+    LatticeTask *task = ctx;
+    Lattice *lat = task->lat;
+    int w = lat->width, h = lat->height, cells = w * h;
+    const float *src = lat->f[lat->cur];
+    float *dst = lat->f[lat->cur ^ 1];
+    const unsigned char *solid = lat->solid;
+    float fx = 0.0f, fy = 0.0f;
+    Vector2D *body_force = task->workers[worker].body_force;
+    memset(body_force, 0, MAX_BODIES * sizeof(Vector2D));
+
+    int y_begin, y_end;
+    worker_range(h, worker, num_workers, 1, &y_begin, &y_end);
+
+    for (int bx = 0; bx < w; bx += LBM_BLOCK) {
+        int bx_end = bx + LBM_BLOCK < w ? bx + LBM_BLOCK : w;
+        for (int y = y_begin; y < y_end; y++) {
+            int row[3] = {((y + h - 1) % h) * w, y * w, ((y + 1) % h) * w}; // Rows y-1, y, y+1
+            for (int x = bx; x < bx_end; x++) {
+                int idx = y * w + x;
+                if (solid[idx]) continue;
+                if (x == 0) {
+                    lattice_set_equilibrium(dst, cells, idx, task->inlet_u, 0.0f);
+                    continue;
+                }
+
+                float fi[9], rho = 0.0f, mx = 0.0f, my = 0.0f;
+                for (int q = 0; q < 9; q++) {
+                    int sx = x - lbm_cx[q];
+                    if (sx >= w) sx = w - 1;
+                    int sidx = row[1 - lbm_cy[q]] + sx;
+                    if (solid[sidx]) {
+                        int o = lbm_opp[q];
+                        fi[q] = src[o * cells + idx];
+                        fx += 2.0f * fi[q] * lbm_cx[o];
+                        fy += 2.0f * fi[q] * lbm_cy[o];
+                        body_force[solid[sidx] - 1].x += 2.0f * fi[q] * lbm_cx[o];
+                        body_force[solid[sidx] - 1].y += 2.0f * fi[q] * lbm_cy[o];
+                    } else {
+                        fi[q] = src[q * cells + sidx];
+                    }
+                    rho += fi[q];
+                    mx += fi[q] * lbm_cx[q];
+                    my += fi[q] * lbm_cy[q];
+                }
+
+                float ux = mx / rho, uy = my / rho;
+                for (int q = 0; q < 9; q++) {
+                    dst[q * cells + idx] = fi[q] + task->omega * (lattice_equilibrium(q, rho, ux, uy) - fi[q]);
+                }
+            }
+        }
+    }
+    task->workers[worker].force = (Vector2D){fx, fy};
+}
+
+void lattice_step(SimState *state) {
+    Lattice *lat = &state->lattice;
+    float inlet_u = state->air_speed * LBM_SPEED_SCALE;
+    if (lat->width != state->screen_width || lat->height != state->screen_height || lat->f[0] == NULL) {
+        lattice_init(lat, state->screen_width, state->screen_height, inlet_u);
+    }
+    lattice_sync_obstacle(lat, &state->obstacle, inlet_u);
+
+    LatticeTask task = {lat, state->workers, inlet_u, 1.0f / LBM_TAU};
+    pool_run(state->pool, lattice_worker, &task);
+    lat->cur ^= 1;
+
+    Vector2D force = reduce_worker_forces(state);
+    state->total_force = (Vector2D){force.x * LBM_FORCE_SCALE, force.y * LBM_FORCE_SCALE};
+    reduce_body_forces(state, LBM_FORCE_SCALE);
+}
+
+// Speed at a lattice cell relative to the inflow, for display
+static float lattice_speed(const Lattice *lat, int x, int y) {
+    int cells = lat->width * lat->height, idx = y * lat->width + x;
+    const float *f = lat->f[lat->cur];
+    float rho = 0.0f, mx = 0.0f, my = 0.0f;
+    for (int q = 0; q < 9; q++) {
+        float v = f[q * cells + idx];
+        rho += v;
+        mx += v * lbm_cx[q];
+        my += v * lbm_cy[q];
+    }
+    return sqrtf(mx * mx + my * my) / rho;
+}
+
+// Display level of every cell from the flow speed; all 0 until the lattice exists
+static void lattice_levels(const SimState *state, unsigned char *levels) {
+    const Lattice *lat = &state->lattice;
+    int cells = state->screen_width * state->screen_height;
+    memset(levels, 0, cells);
+    if (lat->f[0] == NULL || lat->width != state->screen_width || lat->height != state->screen_height) return;
+    float inlet_u = state->air_speed * LBM_SPEED_SCALE;
+    for (int i = 0; i < cells; i++) {
+        if (lat->solid[i]) continue;
+        int level = (int)(lattice_speed(lat, i % lat->width, i / lat->width) / inlet_u * 6.0f);
+        levels[i] = (unsigned char)(level <= 0 ? 0 : level > DENSITY_LEVELS ? DENSITY_LEVELS : level);
+    }
+}
+
+
+// --- Physics Thread ---
+int command_push(CommandQueue *q, CommandType type, float value) {
+    unsigned int tail = q->tail;
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == COMMAND_QUEUE_SIZE) return 0; // Full: drop
+    q->items[tail % COMMAND_QUEUE_SIZE] = (Command){type, value};
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int command_pop(CommandQueue *q, Command *cmd) {
+    unsigned int head = q->head;
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) return 0;
+    *cmd = q->items[head % COMMAND_QUEUE_SIZE];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Runs on the physics thread between steps
+static void apply_command(SimState *state, const Command *cmd) {
+    switch (cmd->type) {
+        case CMD_FLAP_ANGLE:
+            state->object.angle += cmd->value;
+            break;
+        case CMD_NEXT_SHAPE:
+            // The scene joins the cycle once one is loaded
+            set_shape_type(state, (state->object.type + 1) % (state->scene.num_bodies ? SHAPE_SCENE + 1 : SHAPE_SCENE));
+            break;
+        case CMD_SPEED_STEP:
+            state->air_speed += 0.2;
+            if (state->air_speed > 2.0) state->air_speed = 0.2;
+            break;
+        case CMD_DENSITY_STEP:
+            state->air_density += 0.1;
+            if (state->air_density > 1.0) state->air_density = 0.1;
+            set_particle_count(state);
+            break;
+        case CMD_TOGGLE_ENGINE:
+            state->engine = state->engine == ENGINE_LBM ? ENGINE_PARTICLES : ENGINE_LBM;
+            break;
+        case CMD_TOGGLE_COLLISIONS:
+            state->collisions = !state->collisions;
+            break;
+        case CMD_QUIT:
+            break;
+    }
+}
+
+static void *grow_buffer(void *ptr, int *capacity, int count, size_t elem_size) {
+    if (count <= *capacity) return ptr;
+    void *grown = realloc(ptr, (size_t)count * elem_size);
+    if (grown == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    *capacity = count;
+    return grown;
+}
+
+typedef struct {
+    const SimState *state;
+    unsigned int *counts;   // One grid per worker
+    unsigned char *levels;
+    float level_scale;      // Ramp level per particle in a cell
+    int phase;
+} BinTask;
+
+// Phase 0 counts each worker's particles into its own grid; phase 1 sums the
+// grids over each worker's cells and maps the totals to ramp levels
+static void bin_worker(void *ctx, int worker, int num_workers) {
+    BinTask *task = ctx;
+    const SimState *state = task->state;
+    int w = state->screen_width, h = state->screen_height, cells = w * h;
+    int begin, end;
+
+    if (task->phase == 0) {
+        unsigned int *counts = task->counts + (size_t)worker * cells;
+        const float *px = state->particles.x, *py = state->particles.y;
+        memset(counts, 0, cells * sizeof(unsigned int));
+        worker_range(state->num_particles, worker, num_workers, 8, &begin, &end);
+        for (int i = begin; i < end; i++) {
+            unsigned int x = (unsigned int)(int)roundf(px[i]), y = (unsigned int)(int)roundf(py[i]);
+            if (x < (unsigned int)w && y < (unsigned int)h) counts[y * w + x]++;
+        }
+    } else {
+        worker_range(cells, worker, num_workers, 1, &begin, &end);
+        for (int c = begin; c < end; c++) {
+            unsigned int n = 0;
+            for (int t = 0; t < num_workers; t++) n += task->counts[(size_t)t * cells + c];
+            float level = ceilf(n * task->level_scale);
+            task->levels[c] = (unsigned char)(level > DENSITY_LEVELS ? DENSITY_LEVELS : level);
+        }
+    }
+}
+
+// Particle density per screen cell as ramp levels, so the frame size depends
+// only on the screen and not on the particle count
+static void bin_particles(DensityBins *bins, const SimState *state, unsigned char *levels) {
+    int cells = state->screen_width * state->screen_height;
+    bins->counts = grow_buffer(bins->counts, &bins->capacity, cells * state->pool->num_threads, sizeof(unsigned int));
+    float mean = state->air_density * (float)PARTICLES_PER_CELL;
+    BinTask task = {state, bins->counts, levels, DENSITY_MEAN_LEVEL / (mean > 0 ? mean : 1.0f), 0};
+    pool_run(state->pool, bin_worker, &task);
+    task.phase = 1;
+    pool_run(state->pool, bin_worker, &task);
+}
+
+// Copies what the renderer needs from the simulation into f
+static void fill_frame(Frame *f, const SimState *state, DensityBins *bins, double steps_per_sec) {
+    f->screen_width = state->screen_width;
+    f->screen_height = state->screen_height;
+    f->engine = state->engine;
+    f->collisions = state->collisions;
+    f->shape = state->object.type;
+    f->angle = state->object.angle;
+    f->air_speed = state->air_speed;
+    f->air_density = state->air_density;
+    f->steps_per_sec = steps_per_sec;
+
+    const ForceStats *fs = &state->stats;
+    f->lift_ema = (float)fs->lift.ema;
+    f->drag_ema = (float)fs->drag.ema;
+    f->have_stats = fs->lift.num_batches >= 2;
+    f->lift_mean = fs->lift.mean;
+    f->drag_mean = fs->drag.mean;
+    f->lift_se = f->have_stats ? stat_std_error(&fs->lift) : 0.0;
+    f->drag_se = f->have_stats ? stat_std_error(&fs->drag) : 0.0;
+    f->num_bodies = state->object.type == SHAPE_SCENE ? fs->num_bodies : 0;
+    for (int b = 0; b < f->num_bodies; b++) {
+        f->body_names[b] = state->scene.bodies[b].name;
+        f->body_lift[b] = fs->body_lift_ema[b];
+        f->body_drag[b] = fs->body_drag_ema[b];
+    }
+
+    int screen_cells = state->screen_width * state->screen_height;
+    f->levels = grow_buffer(f->levels, &f->levels_capacity, screen_cells, 1);
+    if (state->engine == ENGINE_PARTICLES) {
+        bin_particles(bins, state, f->levels);
+    } else {
+        lattice_levels(state, f->levels);
+    }
+
+    const ObstacleGrid *grid = &state->obstacle;
+    if (f->obstacle.version != grid->version || f->obstacle.valid != grid->valid) {
+        int cells = grid->valid ? grid->width * grid->height : 0;
+        f->obstacle.solid = grow_buffer(f->obstacle.solid, &f->obstacle.capacity, cells, 1);
+        if (cells > 0) memcpy(f->obstacle.solid, grid->solid, cells);
+        f->obstacle.x0 = grid->x0;
+        f->obstacle.y0 = grid->y0;
+        f->obstacle.width = grid->width;
+        f->obstacle.height = grid->height;
+        f->obstacle.valid = grid->valid;
+        f->obstacle.version = grid->version;
+    }
+}
+
+// Fills the back frame and makes it the ready one
+static void publish_frame(SimThread *sim, double steps_per_sec) {
+    FrameExchange *ex = &sim->frames;
+    fill_frame(&ex->frames[ex->write], sim->state, &sim->bins, steps_per_sec);
+    ex->write = __atomic_exchange_n(&ex->ready, ex->write | FRAME_FRESH, __ATOMIC_ACQ_REL) & ~FRAME_FRESH;
+}
+
+// Latest published frame; keeps returning the same one until a newer one is ready
+const Frame *frame_acquire(FrameExchange *ex) {
+    if (__atomic_load_n(&ex->ready, __ATOMIC_ACQUIRE) & FRAME_FRESH) {
+        ex->read = __atomic_exchange_n(&ex->ready, ex->read, __ATOMIC_ACQ_REL) & ~FRAME_FRESH;
+    }
+    return &ex->frames[ex->read];
+}
+
+// Sleeps to an absolute deadline and advances it by interval. A deadline that
+// has fallen more than one interval behind restarts from now instead of bursting.
+void sleep_until(double *deadline, double interval) {
+    double now = now_seconds();
+    if (*deadline > now) {
+        double wait = *deadline - now;
+        struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+        nanosleep(&ts, NULL);
+    } else if (now - *deadline > interval) {
+        *deadline = now;
+    }
+    *deadline += interval;
+}
+
+static void *sim_thread_main(void *arg) {
+    SimThread *sim = arg;
+    SimState *state = sim->state;
+    double interval = sim->step_rate > 0 ? 1.0 / sim->step_rate : 0.0;
+    double next_step = now_seconds(), next_publish = next_step, rate_start = next_step;
+    double steps_per_sec = 0.0;
+    long rate_steps = 0;
+
+    for (;;) {
+        Command cmd;
+        while (command_pop(&sim->commands, &cmd)) {
+            if (cmd.type == CMD_QUIT) return NULL;
+            apply_command(state, &cmd);
+        }
+
+        update_simulation(state);
+        rate_steps++;
+
+        double now = now_seconds();
+        if (now - rate_start >= 0.5) {
+            steps_per_sec = rate_steps / (now - rate_start);
+            rate_start = now;
+            rate_steps = 0;
+        }
+        // No point copying state faster than the terminal shows it
+        if (now >= next_publish) {
+            publish_frame(sim, steps_per_sec);
+            next_publish = now + 1.0 / DISPLAY_RATE;
+        }
+        if (interval > 0) sleep_until(&next_step, interval);
+    }
+}
+
+// Publishes the initial state so the renderer always has a frame, then starts stepping
+void sim_thread_start(SimThread *sim) {
+    sim->frames.write = 0;
+    sim->frames.ready = 1;
+    sim->frames.read = 2;
+    publish_frame(sim, 0.0);
+    frame_acquire(&sim->frames);
+    if (pthread_create(&sim->thread, NULL, sim_thread_main, sim) != 0) {
+        fprintf(stderr, "Failed to start the physics thread\n");
+        exit(1);
+    }
+}
+
+void sim_thread_stop(SimThread *sim) {
+    while (!command_push(&sim->commands, CMD_QUIT, 0)) usleep(1000);
+    pthread_join(sim->thread, NULL);
+    for (int i = 0; i < 3; i++) {
+        Frame *f = &sim->frames.frames[i];
+        free(f->levels);
+        obstacle_grid_free(&f->obstacle);
+    }
+    free(sim->bins.counts);
+}
+
+
+// --- Drawing and UI ---
+void renderer_init(Renderer *r) {
+    *r = (Renderer){0};
+    r->colors = has_colors();
+    if (r->colors) {
+        // Density ramp: sparse blue through cyan, green and yellow to dense red
+        static const short ramp_colors[DENSITY_LEVELS] = {
+            COLOR_BLUE, COLOR_BLUE, COLOR_CYAN, COLOR_CYAN, COLOR_GREEN,
+            COLOR_GREEN, COLOR_YELLOW, COLOR_YELLOW, COLOR_RED
+        };
+        start_color();
+        use_default_colors();
+        for (int level = 1; level <= DENSITY_LEVELS; level++) init_pair(level, ramp_colors[level - 1], -1);
+    }
+}
+
+void renderer_free(Renderer *r) {
+    free(r->shown);
+    free(r->shape);
+    *r = (Renderer){0};
+}
+
+static void renderer_resize(Renderer *r, int width, int height) {
+    if (r->width == width && r->height == height) return;
+    free(r->shown);
+    free(r->shape);
+    r->shown = calloc((size_t)width * height, sizeof(chtype));
+    r->shape = calloc((size_t)width * height, 1);
+    if (r->shown == NULL || r->shape == NULL) {
+        endwin();
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    r->width = width;
+    r->height = height;
+    r->shape_valid = 0;
+    erase();
+}
+
+// Marks a rectangle as needing a redraw, for cells covered by overlays this frame
+static void renderer_touch(Renderer *r, int x0, int y0, int w, int h) {
+    for (int y = y0 < 0 ? 0 : y0; y < y0 + h && y < r->height; y++) {
+        for (int x = x0 < 0 ? 0 : x0; x < x0 + w && x < r->width; x++) r->shown[y * r->width + x] = 0;
+    }
+}
+
+// Rasterizes the obstacle into the renderer's screen mask; only redone when the obstacle changes
+void draw_shape(Renderer *r, const ObstacleGrid *grid) {
+    if (r->shape_valid && grid->version == r->shape_version) return;
+    memset(r->shape, 0, (size_t)r->width * r->height);
+    if (grid->valid) {
+        for (int y = 0; y < grid->height; y++) {
+            for (int x = 0; x < grid->width; x++) {
+                unsigned int sx = (unsigned int)(grid->x0 + x), sy = (unsigned int)(grid->y0 + y);
+                if (grid->solid[y * grid->width + x] && sx < (unsigned int)r->width && sy < (unsigned int)r->height) {
+                    r->shape[sy * r->width + sx] = 1;
+                }
+            }
+        }
+    }
+    r->shape_version = grid->version;
+    r->shape_valid = 1;
+}
+
+// Density (or LBM speed) ramp plus the obstacle; only cells whose glyph
+// changed since the last frame are sent to ncurses
+static void draw_field(Renderer *r, const Frame *frame) {
+    static const char ramp[] = " .:-=+*#%@";
+    for (int y = 0; y < r->height; y++) {
+        for (int x = 0; x < r->width; x++) {
+            int c = y * r->width + x;
+            int level = frame->levels[c];
+            chtype ch;
+            if (r->shape[c]) ch = ' ' | A_REVERSE;
+            else if (level == 0) ch = ' ';
+            else ch = (chtype)ramp[level] | (r->colors ? COLOR_PAIR(level) : 0);
+            if (ch != r->shown[c]) {
+                mvaddch(y, x, ch);
+                r->shown[c] = ch;
+            }
+        }
+    }
+}
+
+void draw_force_gauges(Renderer *r, const Frame *frame) {
+    int gauge_x = frame->screen_width - 25;
+    int gauge_y = 5;
+    renderer_touch(r, gauge_x, gauge_y - 2, 25, 11);
+    
+    // Note: In physics, positive Y is up. In ncurses, it's down.
+    // We calculate force so that positive force.y is UPWARD LIFT.
+    // The bars show the smoothed value; the numbers are the running mean and its standard error.
+    float lift = frame->lift_ema;
+    float drag = frame->drag_ema;
+
+    // Scale the forces to make the bars visible
+    float scale = 3.0f;
+    int lift_bar = (int)(lift * scale);
+    int drag_bar = (int)(drag * scale);
     
     mvprintw(gauge_y - 2, gauge_x, "--- FORCES ---");
     mvprintw(gauge_y, gauge_x, "LIFT");
     mvprintw(gauge_y + 5, gauge_x, "DRAG");
+    if (frame->have_stats) {
+        mvprintw(gauge_y + 7, gauge_x, "L %7.3f +- %.3f", frame->lift_mean, frame->lift_se);
+        mvprintw(gauge_y + 8, gauge_x, "D %7.3f +- %.3f", frame->drag_mean, frame->drag_se);
+    }
     
     // Draw LIFT gauge (can be positive or negative)
     mvaddch(gauge_y + 2, gauge_x + 4, '|');
@@ -277,87 +2939,481 @@ void draw_force_gauges(const SimState *state) {
     // Draw DRAG gauge
     mvaddch(gauge_y + 5, gauge_x + 4, '|');
     for (int i = 0; i < drag_bar && i < 15; i++) mvaddch(gauge_y + 5, gauge_x + 5 + i, '=');
-}
 
-void draw_frame(const SimState *state) {
-    clear();
-    for (int i = 0; i < state->num_particles; i++) {
-        mvaddch((int)roundf(state->particles[i].pos.y), (int)roundf(state->particles[i].pos.x), '.');
+    // One smoothed line per scene body
+    renderer_touch(r, gauge_x, gauge_y + 10, 25, frame->num_bodies);
+    for (int b = 0; b < frame->num_bodies; b++) {
+        mvprintw(gauge_y + 10 + b, gauge_x, "%-8.8s L%6.2f D%6.2f", frame->body_names[b], frame->body_lift[b], frame->body_drag[b]);
     }
-    draw_shape(&state->object);
-    draw_force_gauges(state); // Draw the new UI
+}
 
-    const char* shape_name;
-    switch(state->object.type) {
-        case SHAPE_FLAP: shape_name = "Flap"; break;
-        case SHAPE_SQUARE: shape_name = "Square"; break;
-        case SHAPE_AEROFOIL: shape_name = "Aerofoil"; break;
-        case SHAPE_CIRCLE: shape_name = "Circle"; break;
-        default: shape_name = "Unknown"; break;
-    }
+// Draws into the ncurses buffer; the caller refreshes
+void draw_frame(Renderer *r, const Frame *frame) {
+    renderer_resize(r, frame->screen_width, frame->screen_height);
+    draw_shape(r, &frame->obstacle);
+    draw_field(r, frame);
+    draw_force_gauges(r, frame); // Draw the new UI
+
+    const char* shape_name = shape_type_name(frame->shape);
     
     attron(A_REVERSE);
-    mvprintw(state->screen_height - 1, 1, "Speed: %.2f | Density: %.2f | Shape: %s",
-             state->air_speed, state->air_density, shape_name);
+    mvprintw(frame->screen_height - 1, 1, "Speed: %.2f | Density: %.2f | Shape: %s | Engine: %s | %.0f steps/s",
+             frame->air_speed, frame->air_density, shape_name,
+             frame->engine == ENGINE_LBM ? "LBM" : "Particles", frame->steps_per_sec);
     
-    if (state->object.type == SHAPE_FLAP) {
-        mvprintw(state->screen_height - 2, 1, " Angle: %.2f rad | Controls: W/S ", state->object.angle);
-    }
+    mvprintw(frame->screen_height - 2, 1, " Angle: %.2f rad | Controls: W/S ", frame->angle);
 
-    mvprintw(state->screen_height - 1, state->screen_width - 20, "Press 'm' for Menu ");
+    mvprintw(frame->screen_height - 1, frame->screen_width - 20, "Press 'm' for Menu ");
     attroff(A_REVERSE);
-
-    refresh();
+    renderer_touch(r, 0, frame->screen_height - 2, frame->screen_width, 2);
 }
 
-void show_menu(SimState *state) {
-    nodelay(stdscr, FALSE);
+// Menu overlay; its keys are turned into commands by the main loop
+void draw_menu(Renderer *r, const Frame *frame) {
+    int menu_width = 45, menu_height = 10;
+    int menu_x = frame->screen_width / 2 - menu_width / 2;
+    int menu_y = frame->screen_height / 2 - menu_height / 2;
+    renderer_touch(r, menu_x, menu_y, menu_width, menu_height);
+
+    attron(A_REVERSE);
+    for(int y=0; y<menu_height; ++y) mvhline(menu_y + y, menu_x, ' ', menu_width);
+    mvprintw(menu_y + 1, menu_x + 2, "--- SETTINGS MENU ---");
+    attroff(A_REVERSE);
     
-    int menu_width = 45, menu_height = 8;
-    int menu_x = state->screen_width / 2 - menu_width / 2;
-    int menu_y = state->screen_height / 2 - menu_height / 2;
+    const char* shape_name = shape_type_name(frame->shape);
 
-    int running = 1;
-    while(running) {
-        attron(A_REVERSE);
-        for(int y=0; y<menu_height; ++y) mvhline(menu_y + y, menu_x, ' ', menu_width);
-        mvprintw(menu_y + 1, menu_x + 2, "--- SETTINGS MENU ---");
-        attroff(A_REVERSE);
-        
-        const char* shape_name;
-        switch(state->object.type) {
-             case SHAPE_FLAP: shape_name = "Flap"; break;
-             case SHAPE_SQUARE: shape_name = "Square"; break;
-             case SHAPE_AEROFOIL: shape_name = "Aerofoil"; break;
-             case SHAPE_CIRCLE: shape_name = "Circle"; break;
-             default: shape_name = "Unknown"; break;
-        }
-
-        mvprintw(menu_y + 3, menu_x + 2, "1. Change Shape (Current: %s)", shape_name);
-        mvprintw(menu_y + 4, menu_x + 2, "2. Change Air Speed (Current: %.2f)", state->air_speed);
-        mvprintw(menu_y + 5, menu_x + 2, "3. Change Air Density (Current: %.2f)", state->air_density);
-        mvprintw(menu_y + 6, menu_x + 2, "Press 'm' or 'q' to exit menu");
-        
-        int choice = getch();
-        switch (choice) {
-            case '1':
-                state->object.type = (state->object.type + 1) % 4;
-                state->object.pos = (Vector2D){state->screen_width / 3, state->screen_height / 2};
-                if(state->object.type == SHAPE_FLAP) state->object.size = (Vector2D){25, 4};
-                else if (state->object.type == SHAPE_AEROFOIL) state->object.size = (Vector2D){25, 8};
-                else state->object.size = (Vector2D){15, 15};
-                break;
-            case '2':
-                state->air_speed += 0.2;
-                if (state->air_speed > 2.0) state->air_speed = 0.2;
-                break;
-            case '3':
-                state->air_density += 0.1;
-                if (state->air_density > 1.0) state->air_density = 0.1;
-                init_simulation(state);
-                break;
-            case 'm': case 'q': running = 0; break;
+    mvprintw(menu_y + 3, menu_x + 2, "1. Change Shape (Current: %s)", shape_name);
+    mvprintw(menu_y + 4, menu_x + 2, "2. Change Air Speed (Current: %.2f)", frame->air_speed);
+    mvprintw(menu_y + 5, menu_x + 2, "3. Change Air Density (Current: %.2f)", frame->air_density);
+    mvprintw(menu_y + 6, menu_x + 2, "4. Change Engine (Current: %s)", frame->engine == ENGINE_LBM ? "LBM" : "Particles");
+    mvprintw(menu_y + 7, menu_x + 2, "5. Particle Collisions (Current: %s)", frame->collisions ? "On" : "Off");
+    mvprintw(menu_y + 8, menu_x + 2, "Press 'm' or 'q' to exit menu");
+}
+
+
+// --- Recording and Replay ---
+static int chunk_ring_push(ChunkRing *ring, int idx) {
+    unsigned int tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RECORD_QUEUE) return 0;
+    ring->items[tail % RECORD_QUEUE] = idx;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int chunk_ring_pop(ChunkRing *ring, int *idx) {
+    unsigned int head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) return 0;
+    *idx = ring->items[head % RECORD_QUEUE];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Sleeps until a chunk is queued, writes it and hands the buffer back
+static void *record_writer_main(void *arg) {
+    Recorder *rec = arg;
+    for (;;) {
+        sem_wait(&rec->ready);
+        int idx;
+        if (!chunk_ring_pop(&rec->full, &idx)) {
+            if (__atomic_load_n(&rec->quit, __ATOMIC_ACQUIRE)) return NULL;
+            continue;
         }
+        RecordChunk *chunk = &rec->chunks[idx];
+        if (!rec->write_error && fwrite(chunk->data, 1, chunk->size, rec->file) != chunk->size) rec->write_error = 1;
+        chunk_ring_push(&rec->spare, idx);
+    }
+}
+
+// Writes the header and starts the writer thread; NULL (with a message) on failure
+Recorder *recorder_open(const char *path, const SimState *state, int every, int delta) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s for writing\n", path);
+        return NULL;
+    }
+    RecordHeader header = {0};
+    memcpy(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    header.version = RECORD_VERSION;
+    header.header_size = sizeof(RecordHeader);
+    header.width = (uint32_t)state->screen_width;
+    header.height = (uint32_t)state->screen_height;
+    header.seed = state->seed;
+    header.engine = (uint32_t)state->engine;
+    header.collisions = (uint32_t)state->collisions;
+    header.record_every = (uint32_t)every;
+    header.flags = delta ? RECORD_FLAG_DELTA : 0;
+    header.time_step = state->time_step;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    Recorder *rec = calloc(1, sizeof(Recorder));
+    if (rec == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    rec->file = file;
+    rec->path = path;
+    rec->every = every;
+    rec->delta = delta;
+    for (int i = 0; i < RECORD_QUEUE; i++) chunk_ring_push(&rec->spare, i);
+    sem_init(&rec->ready, 0, 0);
+    if (pthread_create(&rec->thread, NULL, record_writer_main, rec) != 0) {
+        fprintf(stderr, "Failed to start the recording thread\n");
+        exit(1);
     }
+    return rec;
+}
+
+// Flushes the queued frames, stops the writer and reports what was recorded
+void recorder_close(Recorder *rec) {
+    if (rec == NULL) return;
+    __atomic_store_n(&rec->quit, 1, __ATOMIC_RELEASE);
+    sem_post(&rec->ready);
+    pthread_join(rec->thread, NULL);
+    if (fclose(rec->file) != 0) rec->write_error = 1;
+    sem_destroy(&rec->ready);
+
+    if (rec->write_error) fprintf(stderr, "Error writing %s; the recording is incomplete\n", rec->path);
+    fprintf(stderr, "recorded %u frames to %s (%u dropped)\n", rec->frames, rec->path, rec->dropped);
+    for (int i = 0; i < RECORD_QUEUE; i++) free(rec->chunks[i].data);
+    free(rec->prev_x);
+    free(rec->prev_y);
+    free(rec);
+}
+
+static inline uint16_t quantize_position(float v, float extent) {
+    float q = v / extent * 65535.0f + 0.5f;
+    return (uint16_t)(q < 0.0f ? 0.0f : q > 65535.0f ? 65535.0f : q);
+}
+
+static inline unsigned char *put_varint(unsigned char *out, uint32_t v) {
+    while (v >= 0x80) {
+        *out++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (unsigned char)v;
+    return out;
+}
+
+// Zigzag varint of the wrapped 16-bit difference; small moves take one byte
+static unsigned char *put_deltas(unsigned char *out, const float *pos, uint16_t *prev, int n, float extent) {
+    for (int i = 0; i < n; i++) {
+        uint16_t q = quantize_position(pos[i], extent);
+        int16_t d = (int16_t)(uint16_t)(q - prev[i]);
+        out = put_varint(out, (uint16_t)((d << 1) ^ (d >> 15)));
+        prev[i] = q;
+    }
+    return out;
+}
+
+static void encode_frame(Recorder *rec, const SimState *state, RecordChunk *chunk, uint64_t step) {
+    int lbm = state->engine == ENGINE_LBM;
+    int n = lbm ? 0 : state->num_particles;
+    size_t cells = (size_t)state->screen_width * state->screen_height;
+    size_t max_size = sizeof(RecordFrame) + (lbm ? cells : (size_t)n * 2 * 3);
+    if (chunk->capacity < max_size) {
+        free(chunk->data);
+        chunk->data = malloc(max_size);
+        if (chunk->data == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        chunk->capacity = max_size;
+    }
+
+    const ParticleArrays *p = &state->particles;
+    float width = (float)state->screen_width, height = (float)state->screen_height;
+    unsigned char *payload = chunk->data + sizeof(RecordFrame), *out = payload;
+    int delta = !lbm && rec->delta && n == rec->prev_count && rec->since_keyframe < RECORD_KEYFRAME_INTERVAL;
+    if (lbm) {
+        lattice_levels(state, out);
+        out += cells;
+        rec->prev_count = -1; // The next particle frame is a keyframe
+    } else if (delta) {
+        out = put_deltas(out, p->x, rec->prev_x, n, width);
+        out = put_deltas(out, p->y, rec->prev_y, n, height);
+        rec->since_keyframe++;
+    } else {
+        if (n > rec->prev_capacity) {
+            free(rec->prev_x);
+            free(rec->prev_y);
+            rec->prev_x = malloc((size_t)n * sizeof(uint16_t));
+            rec->prev_y = malloc((size_t)n * sizeof(uint16_t));
+            if (rec->prev_x == NULL || rec->prev_y == NULL) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+            rec->prev_capacity = n;
+        }
+        for (int i = 0; i < n; i++) rec->prev_x[i] = quantize_position(p->x[i], width);
+        for (int i = 0; i < n; i++) rec->prev_y[i] = quantize_position(p->y[i], height);
+        memcpy(out, rec->prev_x, (size_t)n * sizeof(uint16_t));
+        out += (size_t)n * sizeof(uint16_t);
+        memcpy(out, rec->prev_y, (size_t)n * sizeof(uint16_t));
+        out += (size_t)n * sizeof(uint16_t);
+        rec->prev_count = n;
+        rec->since_keyframe = 0;
+    }
+
+    RecordFrame frame = {0};
+    frame.magic = RECORD_FRAME_MAGIC;
+    frame.payload_size = (uint32_t)(out - payload);
+    frame.step = step;
+    frame.num_particles = (uint32_t)n;
+    frame.encoding = lbm ? RECORD_LEVELS : delta ? RECORD_DELTA : RECORD_RAW;
+    frame.lift = state->total_force.y;
+    frame.drag = state->total_force.x;
+    frame.shape = (uint32_t)state->object.type;
+    frame.angle = state->object.angle;
+    frame.air_speed = state->air_speed;
+    frame.air_density = state->air_density;
+    frame.shape_pos[0] = state->object.pos.x;
+    frame.shape_pos[1] = state->object.pos.y;
+    frame.shape_size[0] = state->object.size.x;
+    frame.shape_size[1] = state->object.size.y;
+    memcpy(chunk->data, &frame, sizeof(frame));
+    chunk->size = sizeof(RecordFrame) + frame.payload_size;
+}
+
+// Called once per step by update_simulation; encodes every rec->every-th step
+void record_step(Recorder *rec, const SimState *state) {
+    uint64_t step = rec->step++;
+    if (step % (uint64_t)rec->every != 0) return;
+    int idx;
+    if (!chunk_ring_pop(&rec->spare, &idx)) {
+        rec->dropped++; // The delta base stays at the last queued frame
+        return;
+    }
+    encode_frame(rec, state, &rec->chunks[idx], step);
+    chunk_ring_push(&rec->full, idx);
+    sem_post(&rec->ready);
+    rec->frames++;
+}
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    RecordHeader header;
+    size_t *offsets;       // File offset of every complete frame
+    int num_frames;
+    int current;           // Frame held in qx/qy, -1 = none
+    uint16_t *qx, *qy;
+    int count, capacity;
+} Replay;
+
+static RecordFrame replay_frame(const Replay *rp, int k) {
+    RecordFrame frame;
+    memcpy(&frame, rp->data + rp->offsets[k], sizeof(frame));
+    return frame;
+}
+
+static void replay_close(Replay *rp) {
+    if (rp->data != NULL) munmap((void *)rp->data, rp->size);
+    free(rp->offsets);
+    free(rp->qx);
+    free(rp->qy);
+    *rp = (Replay){0};
+}
+
+// Maps the file and indexes its frames; a truncated last frame is ignored
+static int replay_open(Replay *rp, const char *path) {
+    *rp = (Replay){0};
+    rp->current = -1;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    rp->size = (size_t)st.st_size;
+    void *data = rp->size > 0 ? mmap(NULL, rp->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s\n", path);
+        return 1;
+    }
+    rp->data = data;
+
+    if (rp->size < sizeof(RecordHeader) || memcmp(rp->data, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0) {
+        fprintf(stderr, "%s is not an AeroSim recording\n", path);
+        replay_close(rp);
+        return 1;
+    }
+    memcpy(&rp->header, rp->data, sizeof(RecordHeader));
+    if (rp->header.version > RECORD_VERSION || rp->header.header_size < sizeof(RecordHeader) ||
+        rp->header.header_size > rp->size || rp->header.width == 0 || rp->header.height == 0) {
+        fprintf(stderr, "%s: unsupported recording version %u\n", path, rp->header.version);
+        replay_close(rp);
+        return 1;
+    }
+
+    int capacity = 0;
+    size_t off = rp->header.header_size;
+    while (off + sizeof(RecordFrame) <= rp->size) {
+        RecordFrame frame;
+        memcpy(&frame, rp->data + off, sizeof(frame));
+        if (frame.magic != RECORD_FRAME_MAGIC || frame.payload_size > rp->size - off - sizeof(frame)) break;
+        if (rp->num_frames == capacity) rp->offsets = grow_buffer(rp->offsets, &capacity, capacity * 2 + 64, sizeof(size_t));
+        rp->offsets[rp->num_frames++] = off;
+        off += sizeof(frame) + frame.payload_size;
+    }
+    if (rp->num_frames == 0) {
+        fprintf(stderr, "%s holds no frames\n", path);
+        replay_close(rp);
+        return 1;
+    }
+    return 0;
+}
+
+static const unsigned char *get_deltas(const unsigned char *in, const unsigned char *end, uint16_t *q, int n) {
+    for (int i = 0; i < n; i++) {
+        uint32_t v = 0;
+        for (int shift = 0; in < end && shift < 32; shift += 7) {
+            unsigned char b = *in++;
+            v |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        int16_t d = (int16_t)((v >> 1) ^ (0u - (v & 1)));
+        q[i] = (uint16_t)(q[i] + d);
+    }
+    return in;
+}
+
+static void replay_decode_one(Replay *rp, int k) {
+    RecordFrame frame = replay_frame(rp, k);
+    const unsigned char *in = rp->data + rp->offsets[k] + sizeof(frame), *end = in + frame.payload_size;
+    int n = (int)frame.num_particles;
+    if (frame.encoding == RECORD_LEVELS) {
+        rp->count = 0; // Read straight from the file by run_replay
+        return;
+    }
+    if (frame.encoding == RECORD_DELTA && n == rp->count) {
+        in = get_deltas(in, end, rp->qx, n);
+        get_deltas(in, end, rp->qy, n);
+        return;
+    }
+    int capacity = rp->capacity;
+    rp->qx = grow_buffer(rp->qx, &capacity, n, sizeof(uint16_t));
+    rp->qy = grow_buffer(rp->qy, &rp->capacity, n, sizeof(uint16_t));
+    if ((size_t)n * 2 * sizeof(uint16_t) > frame.payload_size) n = 0; // Corrupt frame: show it empty
+    memcpy(rp->qx, in, (size_t)n * sizeof(uint16_t));
+    memcpy(rp->qy, in + (size_t)n * sizeof(uint16_t), (size_t)n * sizeof(uint16_t));
+    rp->count = n;
+}
+
+// Decodes frame k, continuing from the current frame when stepping forward
+// and from the nearest keyframe otherwise
+static void replay_seek(Replay *rp, int k) {
+    if (k == rp->current) return;
+    int start = k;
+    if (rp->current < 0 || k != rp->current + 1) {
+        while (start > 0 && replay_frame(rp, start).encoding == RECORD_DELTA) start--;
+    }
+    for (int i = start; i <= k; i++) replay_decode_one(rp, i);
+    rp->current = k;
+}
+
+// Plays a recording through the normal frame/renderer path without stepping physics
+int run_replay(const RunOptions *opts) {
+    Replay rp;
+    if (replay_open(&rp, opts->replay_path)) return 1;
+
+    SimState view = {0};
+    view.screen_width = (int)rp.header.width;
+    view.screen_height = (int)rp.header.height;
+    view.engine = rp.header.engine == ENGINE_LBM ? ENGINE_LBM : ENGINE_PARTICLES;
+    view.collisions = (int)rp.header.collisions;
+    view.time_step = rp.header.time_step;
+    view.pool = pool_create(opts->threads);
+    // Recordings of a scene store only the control angle; the bodies come from the same file
+    if (opts->scene_path && scene_load(&view.scene, opts->scene_path)) {
+        free_simulation(&view);
+        replay_close(&rp);
+        return 1;
+    }
+
+    initscr();
+    noecho();
+    cbreak();
+    curs_set(0);
+    keypad(stdscr, TRUE);
     nodelay(stdscr, TRUE);
+
+    Renderer renderer;
+    renderer_init(&renderer);
+    DensityBins bins = {0};
+    Frame frame = {0};
+    int pos = 0, shown = -1, playing = 1, running = 1;
+    int last = rp.num_frames - 1, skip = rp.num_frames / 10 > 1 ? rp.num_frames / 10 : 1;
+    double next_frame = now_seconds();
+
+    while (running) {
+        int ch;
+        while ((ch = getch()) != ERR) {
+            switch (ch) {
+                case 'q': running = 0; break;
+                case ' ': playing = !playing; break;
+                case KEY_RIGHT: pos++; playing = 0; break;
+                case KEY_LEFT: pos--; playing = 0; break;
+                case KEY_UP: pos += skip; break;
+                case KEY_DOWN: pos -= skip; break;
+                case KEY_HOME: pos = 0; break;
+                case KEY_END: pos = last; break;
+            }
+        }
+        if (pos < 0) pos = 0;
+        if (pos > last) pos = last;
+
+        if (pos != shown) {
+            replay_seek(&rp, pos);
+            RecordFrame rf = replay_frame(&rp, pos);
+            grow_particle_pool(&view.particles, rp.count, 0);
+            float sx = view.screen_width / 65535.0f, sy = view.screen_height / 65535.0f;
+            for (int i = 0; i < rp.count; i++) {
+                view.particles.x[i] = rp.qx[i] * sx;
+                view.particles.y[i] = rp.qy[i] * sy;
+            }
+            view.num_particles = rp.count;
+            view.engine = rf.encoding == RECORD_LEVELS ? ENGINE_LBM : ENGINE_PARTICLES;
+            view.air_speed = rf.air_speed;
+            view.air_density = rf.air_density;
+            view.object.type = rf.shape <= SHAPE_SCENE ? (ShapeType)rf.shape : SHAPE_FLAP;
+            view.object.angle = rf.angle;
+            view.object.pos = (Vector2D){rf.shape_pos[0], rf.shape_pos[1]};
+            view.object.size = (Vector2D){rf.shape_size[0], rf.shape_size[1]};
+            obstacle_grid_update(&view.obstacle, &view.object, &view.scene);
+
+            fill_frame(&frame, &view, &bins, 0.0);
+            size_t cells = (size_t)view.screen_width * view.screen_height;
+            if (rf.encoding == RECORD_LEVELS && rf.payload_size == cells)
+                memcpy(frame.levels, rp.data + rp.offsets[pos] + sizeof(rf), cells);
+            frame.lift_ema = rf.lift;
+            frame.drag_ema = rf.drag;
+            shown = pos;
+        }
+
+        draw_frame(&renderer, &frame);
+        attron(A_REVERSE);
+        mvprintw(0, 1, " Replay frame %d/%d (step %llu) %s | Space play/pause, Left/Right step, Up/Down skip, q quit ",
+                 pos + 1, rp.num_frames, (unsigned long long)replay_frame(&rp, pos).step, playing ? "playing" : "paused");
+        attroff(A_REVERSE);
+        renderer_touch(&renderer, 0, 0, renderer.width, 1);
+        refresh();
+
+        if (playing && pos < last) pos++;
+        sleep_until(&next_frame, 1.0 / DISPLAY_RATE);
+    }
+
+    endwin();
+    renderer_free(&renderer);
+    free(frame.levels);
+    obstacle_grid_free(&frame.obstacle);
+    free(bins.counts);
+    free_simulation(&view);
+    replay_close(&rp);
+    return 0;
 }
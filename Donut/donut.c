@@ -1,76 +1,939 @@
+/*
+ * Spinning ASCII torus, drawn by a small 3D pipeline:
+ * transform -> project -> back-face cull -> scanline raster + z-test -> shade.
+ * gcc -O2 -march=native -pthread -o donut donut.c -lm
+ *
+ * Anything the pipeline draws is a triangle mesh. --surface NAME tessellates
+ * a built-in parametric surface (torus, sphere); the tessellation follows the
+ * projected size so triangles stay a few cells across. --obj FILE loads a
+ * triangle mesh from a Wavefront OBJ file (v and f lines; polygons are split
+ * into fans), centred and scaled to the size of the torus. Faces are
+ * counter-clockwise seen from outside; back faces are culled.
+ *
+ * --threads N splits the triangles across N workers (0 = all cores); each
+ * rasterizes into a private z-buffer and the buffers are merged in worker
+ * order, so the picture is identical to the single-threaded one.
+ *
+ * The rotation follows the clock, so it spins at the same speed on any machine.
+ *
+ * --export FILE [--frames N] [--width W] [--height H] [--fps F] renders N
+ * frames at W x H characters without a terminal, as fast as possible, and
+ * reports frames/s. FILE gets H lines of W characters per frame, back to back;
+ * frame k shows the model at time k / F.
+ */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-int main() {
-    float A = 0, B = 0;
-    const float R1 = 1;
-    const float R2 = 2;
-    const float K2 = 5;
+#define TESS_EDGE 6.0f      // Screen cells along a tessellated triangle edge where the model is nearest
+#define MAX_TESS 2048       // Most segments along either surface parameter
+#define SPEED_A 1.2f        // Rotation speeds in radians per second
+#define SPEED_B 0.6f
+#define FRAME_RATE 30
+#define EXPORT_FRAMES 100
+#define EXPORT_WIDTH 1000
+#define EXPORT_HEIGHT 400
+#define MAX_THREADS 64
+#define MERGE_GAP 6 // Unchanged cells worth resending to save a cursor move (ESC[r;cH is 6-10 bytes)
 
-    const char luminance_chars[] = ".-~:;o=*%B#@";
+static const float R1 = 1;
+static const float R2 = 2;
+static const float K2 = 5;
 
-    for (;;) {
-        struct winsize w;
-        ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-        int width = w.ws_col;
-        int height = w.ws_row;
-
-        float K1 = width * K2 * 3 / (8 * (R1 + R2));
-
-        char output[width * height];
-        float zbuffer[width * height];
-        memset(output, ' ', sizeof(output));
-        memset(zbuffer, 0, sizeof(zbuffer));
-
-        for (float theta = 0; theta < 2 * M_PI; theta += 0.07) {
-            for (float phi = 0; phi < 2 * M_PI; phi += 0.02) {
-                float sinA = sin(A), cosA = cos(A);
-                float sinB = sin(B), cosB = cos(B);
-                float cosTheta = cos(theta), sinTheta = sin(theta);
-                float cosPhi = cos(phi), sinPhi = sin(phi);
-
-                float circleX = R2 + R1 * cosTheta;
-                float circleY = R1 * sinTheta;
-
-                float x = circleX * (cosB * cosPhi + sinA * sinB * sinPhi)
-                         - circleY * cosA * sinB;
-                float y = circleX * (sinB * cosPhi - sinA * cosB * sinPhi)
-                         + circleY * cosA * cosB;
-                float z = K2 + cosA * circleX * sinPhi + circleY * sinA;
-                float ooz = 1 / z;
-
-                int xp = (int)(width / 2 + K1 * ooz * x);
-                int yp = (int)(height / 2 - K1 * ooz * y);
-
-                float L = cosPhi * cosTheta * sinB
-                        - cosA * cosTheta * sinPhi
-                        - sinA * sinTheta
-                        + cosB * (cosA * sinTheta - cosTheta * sinA * sinPhi);
-
-                if (L > 0 && xp >= 0 && xp < width && yp >= 0 && yp < height) {
-                    int idx = xp + yp * width;
-                    if (ooz > zbuffer[idx]) {
-                        zbuffer[idx] = ooz;
-                        int lumIndex = (int)(L * 8);
-                        if (lumIndex > 11) lumIndex = 11;
-                        output[idx] = luminance_chars[lumIndex];
+static const char luminance_chars[] = ".-~:;o=*%B#@";
+
+typedef struct {
+    float x, y, z;
+} Vec3;
+
+// Triangle mesh with per-vertex normals for smooth shading. Vertex attributes
+// are stored as separate arrays so the transform runs SIMD across vertices.
+typedef struct {
+    int num_vertices, num_triangles;
+    float *x, *y, *z;
+    float *nx, *ny, *nz;
+    int (*tri)[3];
+} Mesh;
+
+// A surface p(u, v) with u, v in [0, 1] and its outward unit normal
+typedef struct {
+    const char *name;
+    float u_length, v_length; // Longest u and v lines in model units, for the tessellation density
+    int closed_u, closed_v;   // Parameter wraps around, so the last row joins the first
+    void (*eval)(float u, float v, Vec3 *p, Vec3 *n);
+} Surface;
+
+// Vertices after transform and projection: screen position, 1/z and luminance
+typedef struct {
+    float *sx, *sy, *ooz, *lum;
+    int capacity;
+} Projected;
+
+typedef struct {
+    int width, height;
+    float half_w, half_h, K1;
+    char *output;
+    float *zbuffer;
+} Target;
+
+// Framebuffers that live across frames; reallocated only after SIGWINCH
+typedef struct {
+    int width, height;
+    char *output;   // This frame
+    char *shown;    // What the terminal shows; 0 marks a cell as unknown
+    float *zbuffer;
+    char *out;      // Escape sequences and changed runs for one write()
+    size_t out_cap;
+} Screen;
+
+// Half-open range of cell indices
+typedef struct {
+    int lo, hi;
+} Span;
+
+// Output/z-buffer pair of one worker. Everything outside dirty is blank, so
+// the next frame only has to clear and merge that range.
+typedef struct {
+    char *output;
+    float *zbuffer;
+    size_t capacity;
+    Span dirty;
+} Tile;
+
+typedef void (*PoolTask)(void *ctx, int worker, int num_workers);
+
+typedef struct WorkerPool WorkerPool;
+
+typedef struct {
+    WorkerPool *pool;
+    int id;
+} PoolThreadArg;
+
+struct WorkerPool {
+    pthread_t threads[MAX_THREADS];
+    PoolThreadArg args[MAX_THREADS];
+    int num_threads;
+    pthread_barrier_t start, done;
+    PoolTask task;
+    void *ctx;
+    int quit;
+};
+
+static volatile sig_atomic_t resized = 1;
+static volatile sig_atomic_t quit = 0;
+
+static void on_winch(int sig) {
+    (void)sig;
+    resized = 1;
+}
+
+static void on_quit(int sig) {
+    (void)sig;
+    quit = 1;
+}
+
+static void *xrealloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void screen_resize(Screen *scr) {
+    struct winsize w;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) < 0 || w.ws_col == 0 || w.ws_row == 0) {
+        w.ws_col = 80;
+        w.ws_row = 24;
+    }
+    scr->width = w.ws_col;
+    scr->height = w.ws_row;
+
+    size_t cells = (size_t)scr->width * scr->height;
+    scr->output = xrealloc(scr->output, cells);
+    scr->shown = xrealloc(scr->shown, cells);
+    scr->zbuffer = xrealloc(scr->zbuffer, cells * sizeof(float));
+    // Worst case is every other cell changed: one cursor move per cell plus the clear
+    scr->out_cap = cells * 16 + 64;
+    scr->out = xrealloc(scr->out, scr->out_cap);
+    memset(scr->shown, 0, cells);
+}
+
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            exit(1);
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static char *put_uint(char *p, unsigned int v) {
+    char tmp[10];
+    int n = 0;
+    do tmp[n++] = (char)('0' + v % 10); while (v /= 10);
+    while (n > 0) *p++ = tmp[--n];
+    return p;
+}
+
+// Sends only the runs that changed since the last frame, each behind a cursor
+// move; runs separated by a few unchanged cells are joined.
+static void screen_present(Screen *scr, int clear) {
+    char *p = scr->out;
+    if (clear) {
+        memcpy(p, "\x1b[2J", 4);
+        p += 4;
+    }
+    int w = scr->width;
+    for (int y = 0; y < scr->height; y++) {
+        const char *row = scr->output + (size_t)y * w;
+        char *shown = scr->shown + (size_t)y * w;
+        int x = 0;
+        while (x < w) {
+            if (row[x] == shown[x]) {
+                x++;
+                continue;
+            }
+            int end = x + 1, last = x;
+            while (end < w && end - last <= MERGE_GAP) {
+                if (row[end] != shown[end]) last = end;
+                end++;
+            }
+            *p++ = '\x1b';
+            *p++ = '[';
+            p = put_uint(p, (unsigned int)y + 1);
+            *p++ = ';';
+            p = put_uint(p, (unsigned int)x + 1);
+            *p++ = 'H';
+            memcpy(p, row + x, last + 1 - x);
+            memcpy(shown + x, row + x, last + 1 - x);
+            p += last + 1 - x;
+            x = last + 1;
+        }
+    }
+    if (p > scr->out) write_all(scr->out, p - scr->out);
+}
+
+// --- Models ---
+static void torus_eval(float u, float v, Vec3 *p, Vec3 *n) {
+    float theta = 2 * (float)M_PI * u, phi = 2 * (float)M_PI * v;
+    float cosTheta = cosf(theta), sinTheta = sinf(theta), cosPhi = cosf(phi), sinPhi = sinf(phi);
+    float circleX = R2 + R1 * cosTheta;
+    float circleY = R1 * sinTheta;
+    *p = (Vec3){circleX * cosPhi, circleY, circleX * sinPhi};
+    *n = (Vec3){cosTheta * cosPhi, sinTheta, cosTheta * sinPhi};
+}
+
+static void sphere_eval(float u, float v, Vec3 *p, Vec3 *n) {
+    float phi = 2 * (float)M_PI * u, theta = (float)M_PI * v;
+    *n = (Vec3){sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)};
+    *p = (Vec3){(R1 + R2) * n->x, (R1 + R2) * n->y, (R1 + R2) * n->z};
+}
+
+static const Surface surfaces[] = {
+    {"torus", 2 * (float)M_PI * R1, 2 * (float)M_PI * (R1 + R2), 1, 1, torus_eval},
+    {"sphere", 2 * (float)M_PI * (R1 + R2), (float)M_PI * (R1 + R2), 1, 0, sphere_eval},
+};
+
+static const Surface *find_surface(const char *name) {
+    for (size_t i = 0; i < sizeof(surfaces) / sizeof(surfaces[0]); i++) {
+        if (strcmp(surfaces[i].name, name) == 0) return &surfaces[i];
+    }
+    return NULL;
+}
+
+static void mesh_alloc(Mesh *mesh, int num_vertices, int num_triangles) {
+    size_t n = (size_t)num_vertices * sizeof(float);
+    mesh->x = xrealloc(mesh->x, n);
+    mesh->y = xrealloc(mesh->y, n);
+    mesh->z = xrealloc(mesh->z, n);
+    mesh->nx = xrealloc(mesh->nx, n);
+    mesh->ny = xrealloc(mesh->ny, n);
+    mesh->nz = xrealloc(mesh->nz, n);
+    mesh->tri = xrealloc(mesh->tri, (size_t)num_triangles * sizeof(mesh->tri[0]));
+    mesh->num_vertices = num_vertices;
+    mesh->num_triangles = num_triangles;
+}
+
+static void mesh_free(Mesh *mesh) {
+    free(mesh->x);
+    free(mesh->y);
+    free(mesh->z);
+    free(mesh->nx);
+    free(mesh->ny);
+    free(mesh->nz);
+    free(mesh->tri);
+    *mesh = (Mesh){0};
+}
+
+static Vec3 mesh_vertex(const Mesh *mesh, int i) {
+    return (Vec3){mesh->x[i], mesh->y[i], mesh->z[i]};
+}
+
+static Vec3 face_normal(const Mesh *mesh, const int *t) {
+    Vec3 a = mesh_vertex(mesh, t[0]), b = mesh_vertex(mesh, t[1]), c = mesh_vertex(mesh, t[2]);
+    Vec3 e1 = {b.x - a.x, b.y - a.y, b.z - a.z}, e2 = {c.x - a.x, c.y - a.y, c.z - a.z};
+    return (Vec3){e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x};
+}
+
+// Grid of nu x nv quads, two triangles each. Each triangle is wound so its
+// geometric normal agrees with the surface normal, whatever the parameterisation.
+static void tessellate(Mesh *mesh, const Surface *surface, int nu, int nv) {
+    int cols = surface->closed_u ? nu : nu + 1;
+    int rows = surface->closed_v ? nv : nv + 1;
+    mesh_alloc(mesh, cols * rows, 2 * nu * nv);
+    for (int j = 0; j < rows; j++) {
+        for (int i = 0; i < cols; i++) {
+            Vec3 p, n;
+            surface->eval((float)i / nu, (float)j / nv, &p, &n);
+            int k = j * cols + i;
+            mesh->x[k] = p.x;
+            mesh->y[k] = p.y;
+            mesh->z[k] = p.z;
+            mesh->nx[k] = n.x;
+            mesh->ny[k] = n.y;
+            mesh->nz[k] = n.z;
+        }
+    }
+    int t = 0;
+    for (int j = 0; j < nv; j++) {
+        for (int i = 0; i < nu; i++) {
+            int i1 = (i + 1) % cols, j1 = (j + 1) % rows;
+            int a = j * cols + i, b = j * cols + i1, c = j1 * cols + i1, d = j1 * cols + i;
+            int quad[2][3] = {{a, b, c}, {a, c, d}};
+            for (int q = 0; q < 2; q++, t++) {
+                memcpy(mesh->tri[t], quad[q], sizeof(quad[q]));
+                int *v = mesh->tri[t];
+                Vec3 g = face_normal(mesh, v);
+                float dot = 0;
+                for (int k = 0; k < 3; k++) dot += g.x * mesh->nx[v[k]] + g.y * mesh->ny[v[k]] + g.z * mesh->nz[v[k]];
+                if (dot < 0) {
+                    int tmp = v[1];
+                    v[1] = v[2];
+                    v[2] = tmp;
+                }
+            }
+        }
+    }
+}
+
+// Tessellates the surface so triangle edges are about TESS_EDGE cells long
+// where the model is nearest; returns 1 if the mesh was rebuilt
+static int tessellate_for_scale(Mesh *mesh, const Surface *surface, float K1, int *nu, int *nv) {
+    float scale = K1 / (K2 - R1 - R2); // Cells per model unit at the nearest point
+    int u = (int)ceilf(surface->u_length * scale / TESS_EDGE), v = (int)ceilf(surface->v_length * scale / TESS_EDGE);
+    u = u < 3 ? 3 : u > MAX_TESS ? MAX_TESS : u;
+    v = v < 3 ? 3 : v > MAX_TESS ? MAX_TESS : v;
+    if (u == *nu && v == *nv) return 0;
+    tessellate(mesh, surface, u, v);
+    *nu = u;
+    *nv = v;
+    return 1;
+}
+
+// Vertex index of an OBJ face corner ("i", "i/t", "i//n" or "i/t/n"; negative
+// counts back from the last vertex), or -1 if it is not a valid vertex
+static int obj_index(const char *tok, int num_vertices) {
+    char *end;
+    long i = strtol(tok, &end, 10);
+    if (end == tok || (*end != '\0' && *end != '/')) return -1;
+    if (i < 0) i += num_vertices + 1;
+    return i >= 1 && i <= num_vertices ? (int)i - 1 : -1;
+}
+
+static int obj_error(const char *path, int line, const char *msg) {
+    fprintf(stderr, "%s:%d: %s\n", path, line, msg);
+    return 1;
+}
+
+// Loads v and f records; everything else (normals, texture coordinates,
+// groups, materials) is ignored. Vertex normals are the area-weighted mean of
+// the face normals. The model is centred and scaled to the torus's radius.
+static int mesh_load_obj(Mesh *mesh, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    int vcap = 0, tcap = 0, nv = 0, nt = 0, lineno = 0, failed = 0;
+    Vec3 *verts = NULL;
+    int (*tris)[3] = NULL;
+    char line[4096];
+    while (!failed && fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *save, *kind = strtok_r(line, " \t\r\n", &save);
+        if (kind == NULL || kind[0] == '#') continue;
+        if (strcmp(kind, "v") == 0) {
+            Vec3 p;
+            char *xs = strtok_r(NULL, " \t\r\n", &save), *ys = strtok_r(NULL, " \t\r\n", &save), *zs = strtok_r(NULL, " \t\r\n", &save);
+            if (zs == NULL) {
+                failed = obj_error(path, lineno, "expected: v X Y Z");
+                break;
+            }
+            p = (Vec3){strtof(xs, NULL), strtof(ys, NULL), strtof(zs, NULL)};
+            if (nv == vcap) {
+                vcap = vcap ? 2 * vcap : 1024;
+                verts = xrealloc(verts, (size_t)vcap * sizeof(Vec3));
+            }
+            verts[nv++] = p;
+        } else if (strcmp(kind, "f") == 0) {
+            int first = -1, prev = -1, corners = 0;
+            char *tok;
+            while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+                int idx = obj_index(tok, nv);
+                if (idx < 0) {
+                    failed = obj_error(path, lineno, "bad vertex index");
+                    break;
+                }
+                if (corners == 0) first = idx;
+                if (corners >= 2) {
+                    if (nt == tcap) {
+                        tcap = tcap ? 2 * tcap : 1024;
+                        tris = xrealloc(tris, (size_t)tcap * sizeof(tris[0]));
                     }
+                    tris[nt][0] = first;
+                    tris[nt][1] = prev;
+                    tris[nt][2] = idx;
+                    nt++;
                 }
+                prev = idx;
+                corners++;
             }
+            if (!failed && corners < 3) failed = obj_error(path, lineno, "face needs at least 3 vertices");
         }
+    }
+    fclose(f);
+    if (!failed && nt == 0) failed = obj_error(path, lineno, "no faces");
+    if (failed) {
+        free(verts);
+        free(tris);
+        return 1;
+    }
 
-        printf("\x1b[H");
-        for (int k = 0; k < width * height; k++) {
-            putchar(k % width ? output[k] : '\n');
+    Vec3 lo = verts[0], hi = verts[0];
+    for (int i = 1; i < nv; i++) {
+        lo = (Vec3){fminf(lo.x, verts[i].x), fminf(lo.y, verts[i].y), fminf(lo.z, verts[i].z)};
+        hi = (Vec3){fmaxf(hi.x, verts[i].x), fmaxf(hi.y, verts[i].y), fmaxf(hi.z, verts[i].z)};
+    }
+    Vec3 center = {(lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2};
+    float radius = 0;
+    for (int i = 0; i < nv; i++) {
+        float dx = verts[i].x - center.x, dy = verts[i].y - center.y, dz = verts[i].z - center.z;
+        radius = fmaxf(radius, sqrtf(dx * dx + dy * dy + dz * dz));
+    }
+    float scale = radius > 0 ? (R1 + R2) / radius : 1.0f;
+
+    mesh_alloc(mesh, nv, nt);
+    memcpy(mesh->tri, tris, (size_t)nt * sizeof(tris[0]));
+    for (int i = 0; i < nv; i++) {
+        mesh->x[i] = (verts[i].x - center.x) * scale;
+        mesh->y[i] = (verts[i].y - center.y) * scale;
+        mesh->z[i] = (verts[i].z - center.z) * scale;
+        mesh->nx[i] = mesh->ny[i] = mesh->nz[i] = 0;
+    }
+    for (int t = 0; t < nt; t++) {
+        Vec3 g = face_normal(mesh, mesh->tri[t]);
+        for (int k = 0; k < 3; k++) {
+            int v = mesh->tri[t][k];
+            mesh->nx[v] += g.x;
+            mesh->ny[v] += g.y;
+            mesh->nz[v] += g.z;
         }
+    }
+    for (int i = 0; i < nv; i++) {
+        float len = sqrtf(mesh->nx[i] * mesh->nx[i] + mesh->ny[i] * mesh->ny[i] + mesh->nz[i] * mesh->nz[i]);
+        if (len > 0) {
+            mesh->nx[i] /= len;
+            mesh->ny[i] /= len;
+            mesh->nz[i] /= len;
+        }
+    }
+    free(verts);
+    free(tris);
+    return 0;
+}
 
-        A += 0.04;
-        B += 0.02;
-        usleep(30000);
+static void *pool_thread_main(void *arg);
+
+static WorkerPool *pool_create(int num_threads) {
+    WorkerPool *pool = calloc(1, sizeof(WorkerPool));
+    if (pool == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    pool->num_threads = num_threads;
+    if (num_threads == 1) return pool;
+
+    pthread_barrier_init(&pool->start, NULL, num_threads);
+    pthread_barrier_init(&pool->done, NULL, num_threads);
+    for (int t = 1; t < num_threads; t++) {
+        pool->args[t] = (PoolThreadArg){pool, t};
+        pthread_create(&pool->threads[t], NULL, pool_thread_main, &pool->args[t]);
+    }
+    return pool;
+}
+
+static void *pool_thread_main(void *arg) {
+    PoolThreadArg *a = arg;
+    WorkerPool *pool = a->pool;
+    for (;;) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->quit) break;
+        pool->task(pool->ctx, a->id, pool->num_threads);
+        pthread_barrier_wait(&pool->done);
+    }
+    return NULL;
+}
+
+static void pool_destroy(WorkerPool *pool) {
+    if (pool == NULL) return;
+    if (pool->num_threads > 1) {
+        pool->quit = 1;
+        pthread_barrier_wait(&pool->start);
+        for (int t = 1; t < pool->num_threads; t++) pthread_join(pool->threads[t], NULL);
+        pthread_barrier_destroy(&pool->start);
+        pthread_barrier_destroy(&pool->done);
+    }
+    free(pool);
+}
+
+// Runs task on every worker and returns once all of them have finished
+static void pool_run(WorkerPool *pool, PoolTask task, void *ctx) {
+    if (pool->num_threads == 1) {
+        task(ctx, 0, 1);
+        return;
+    }
+    pool->task = task;
+    pool->ctx = ctx;
+    pthread_barrier_wait(&pool->start);
+    task(ctx, 0, pool->num_threads);
+    pthread_barrier_wait(&pool->done);
+}
+
+// Splits [0, n) into one contiguous range per worker, in worker order
+static void worker_range(int n, int worker, int num_workers, int *begin, int *end) {
+    int chunk = (n + num_workers - 1) / num_workers;
+    *begin = worker * chunk;
+    *end = *begin + chunk;
+    if (*begin > n) *begin = n;
+    if (*end > n) *end = n;
+}
+
+typedef struct {
+    Target target;           // Canvas size and projection; buffers come from the tiles
+    Tile tiles[MAX_THREADS]; // tiles[0] is the caller's pair (the screen or the export frame)
+    Mesh mesh;
+    const Surface *surface;  // NULL for a loaded mesh, which is never re-tessellated
+    int nu, nv;              // Current tessellation of the surface
+    Projected proj;
+    float m[3][3];           // This frame's rotation
+} RenderTask;
+
+static void tile_clear(Tile *tile) {
+    if (tile->dirty.hi > tile->dirty.lo) {
+        memset(tile->output + tile->dirty.lo, ' ', tile->dirty.hi - tile->dirty.lo);
+        memset(tile->zbuffer + tile->dirty.lo, 0, (tile->dirty.hi - tile->dirty.lo) * sizeof(float));
+    }
+    tile->dirty = (Span){0, 0};
+}
+
+static void projected_reserve(Projected *proj, int n) {
+    if (proj->capacity >= n) return;
+    proj->sx = xrealloc(proj->sx, (size_t)n * sizeof(float));
+    proj->sy = xrealloc(proj->sy, (size_t)n * sizeof(float));
+    proj->ooz = xrealloc(proj->ooz, (size_t)n * sizeof(float));
+    proj->lum = xrealloc(proj->lum, (size_t)n * sizeof(float));
+    proj->capacity = n;
+}
+
+// Rotates, projects and lights a contiguous range of vertices, SIMD across
+// vertices. The light comes from (0, 1, -1), so luminance is the rotated
+// normal's y minus its z. Models fit in a sphere of radius R1 + R2 < K2, so
+// every vertex is in front of the eye and no clipping is needed.
+static void project_worker(void *ctx, int worker, int num_workers) {
+    RenderTask *task = ctx;
+    const Mesh *mesh = &task->mesh;
+    const Projected *proj = &task->proj;
+    const float (*m)[3] = task->m;
+    float lx = m[1][0] - m[2][0], ly = m[1][1] - m[2][1], lz = m[1][2] - m[2][2];
+    float K1 = task->target.K1, half_w = task->target.half_w, half_h = task->target.half_h;
+    int i, end;
+    worker_range(mesh->num_vertices, worker, num_workers, &i, &end);
+#if defined(__AVX__)
+    __m256 m00 = _mm256_set1_ps(m[0][0]), m01 = _mm256_set1_ps(m[0][1]), m02 = _mm256_set1_ps(m[0][2]);
+    __m256 m10 = _mm256_set1_ps(m[1][0]), m11 = _mm256_set1_ps(m[1][1]), m12 = _mm256_set1_ps(m[1][2]);
+    __m256 m20 = _mm256_set1_ps(m[2][0]), m21 = _mm256_set1_ps(m[2][1]), m22 = _mm256_set1_ps(m[2][2]);
+    __m256 vlx = _mm256_set1_ps(lx), vly = _mm256_set1_ps(ly), vlz = _mm256_set1_ps(lz);
+    __m256 k1 = _mm256_set1_ps(K1), k2 = _mm256_set1_ps(K2), one = _mm256_set1_ps(1.0f);
+    __m256 vhw = _mm256_set1_ps(half_w), vhh = _mm256_set1_ps(half_h);
+    for (; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_loadu_ps(mesh->x + i), y = _mm256_loadu_ps(mesh->y + i), z = _mm256_loadu_ps(mesh->z + i);
+        __m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m00, x), _mm256_mul_ps(m01, y)), _mm256_mul_ps(m02, z));
+        __m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m10, x), _mm256_mul_ps(m11, y)), _mm256_mul_ps(m12, z));
+        __m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m20, x), _mm256_mul_ps(m21, y)), _mm256_mul_ps(m22, z));
+        __m256 ooz = _mm256_div_ps(one, _mm256_add_ps(rz, k2));
+        __m256 scale = _mm256_mul_ps(k1, ooz);
+        _mm256_storeu_ps(proj->sx + i, _mm256_add_ps(vhw, _mm256_mul_ps(scale, rx)));
+        _mm256_storeu_ps(proj->sy + i, _mm256_sub_ps(vhh, _mm256_mul_ps(scale, ry)));
+        _mm256_storeu_ps(proj->ooz + i, ooz);
+        __m256 nx = _mm256_loadu_ps(mesh->nx + i), ny = _mm256_loadu_ps(mesh->ny + i), nz = _mm256_loadu_ps(mesh->nz + i);
+        _mm256_storeu_ps(proj->lum + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vlx, nx), _mm256_mul_ps(vly, ny)), _mm256_mul_ps(vlz, nz)));
     }
+#elif defined(__SSE2__)
+    __m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]);
+    __m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]);
+    __m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]);
+    __m128 vlx = _mm_set1_ps(lx), vly = _mm_set1_ps(ly), vlz = _mm_set1_ps(lz);
+    __m128 k1 = _mm_set1_ps(K1), k2 = _mm_set1_ps(K2), one = _mm_set1_ps(1.0f);
+    __m128 vhw = _mm_set1_ps(half_w), vhh = _mm_set1_ps(half_h);
+    for (; i + 4 <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(mesh->x + i), y = _mm_loadu_ps(mesh->y + i), z = _mm_loadu_ps(mesh->z + i);
+        __m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m01, y)), _mm_mul_ps(m02, z));
+        __m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, x), _mm_mul_ps(m11, y)), _mm_mul_ps(m12, z));
+        __m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, x), _mm_mul_ps(m21, y)), _mm_mul_ps(m22, z));
+        __m128 ooz = _mm_div_ps(one, _mm_add_ps(rz, k2));
+        __m128 scale = _mm_mul_ps(k1, ooz);
+        _mm_storeu_ps(proj->sx + i, _mm_add_ps(vhw, _mm_mul_ps(scale, rx)));
+        _mm_storeu_ps(proj->sy + i, _mm_sub_ps(vhh, _mm_mul_ps(scale, ry)));
+        _mm_storeu_ps(proj->ooz + i, ooz);
+        __m128 nx = _mm_loadu_ps(mesh->nx + i), ny = _mm_loadu_ps(mesh->ny + i), nz = _mm_loadu_ps(mesh->nz + i);
+        _mm_storeu_ps(proj->lum + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(vlx, nx), _mm_mul_ps(vly, ny)), _mm_mul_ps(vlz, nz)));
+    }
+#endif
+    for (; i < end; i++) {
+        float x = mesh->x[i], y = mesh->y[i], z = mesh->z[i];
+        float rx = m[0][0] * x + m[0][1] * y + m[0][2] * z;
+        float ry = m[1][0] * x + m[1][1] * y + m[1][2] * z;
+        float rz = m[2][0] * x + m[2][1] * y + m[2][2] * z;
+        float ooz = 1 / (rz + K2);
+        proj->sx[i] = half_w + K1 * ooz * rx;
+        proj->sy[i] = half_h - K1 * ooz * ry;
+        proj->ooz[i] = ooz;
+        proj->lum[i] = lx * mesh->nx[i] + ly * mesh->ny[i] + lz * mesh->nz[i];
+    }
+}
+
+// x where the edge from a to b (a above b) crosses row centre yc. Both
+// triangles sharing an edge see its ends in the same order and get the same x.
+static inline float edge_x(const Projected *p, int a, int b, float yc) {
+    return p->sx[a] + (yc - p->sy[a]) * (p->sx[b] - p->sx[a]) / (p->sy[b] - p->sy[a]);
+}
+
+// Fills one front-facing triangle. Cells are sampled at their centres and a
+// cell belongs to the triangle if its centre is in [left, right) x [top,
+// bottom), so triangles sharing an edge neither overlap nor leave a gap.
+// 1/z and luminance are interpolated as planes over the screen.
+static void raster_triangle(const Target *t, const Projected *p, const int *tri, Span *span) {
+    int a = tri[0], b = tri[1], c = tri[2];
+    float area2 = (p->sx[b] - p->sx[a]) * (p->sy[c] - p->sy[a]) - (p->sx[c] - p->sx[a]) * (p->sy[b] - p->sy[a]);
+    if (!(area2 > 0)) return; // Back-facing or edge-on (screen y points down)
+
+    float dbx = p->sx[b] - p->sx[a], dby = p->sy[b] - p->sy[a];
+    float dcx = p->sx[c] - p->sx[a], dcy = p->sy[c] - p->sy[a];
+    float dzb = p->ooz[b] - p->ooz[a], dzc = p->ooz[c] - p->ooz[a];
+    float dlb = p->lum[b] - p->lum[a], dlc = p->lum[c] - p->lum[a];
+    float zdx = (dzb * dcy - dzc * dby) / area2, zdy = (dbx * dzc - dcx * dzb) / area2;
+    float ldx = (dlb * dcy - dlc * dby) / area2, ldy = (dbx * dlc - dcx * dlb) / area2;
+
+    // Sort by y: top, mid, bottom
+    int v0 = a, v1 = b, v2 = c, tmp;
+    if (p->sy[v1] < p->sy[v0]) { tmp = v0; v0 = v1; v1 = tmp; }
+    if (p->sy[v2] < p->sy[v1]) { tmp = v1; v1 = v2; v2 = tmp; }
+    if (p->sy[v1] < p->sy[v0]) { tmp = v0; v0 = v1; v1 = tmp; }
 
+    int y_begin = (int)ceilf(p->sy[v0] - 0.5f), y_end = (int)ceilf(p->sy[v2] - 0.5f);
+    if (y_begin < 0) y_begin = 0;
+    if (y_end > t->height) y_end = t->height;
+    for (int y = y_begin; y < y_end; y++) {
+        float yc = y + 0.5f;
+        float x_long = edge_x(p, v0, v2, yc);
+        float x_short = yc < p->sy[v1] ? edge_x(p, v0, v1, yc) : edge_x(p, v1, v2, yc);
+        float xl = x_long < x_short ? x_long : x_short, xr = x_long < x_short ? x_short : x_long;
+        int x_begin = (int)ceilf(xl - 0.5f), x_end = (int)ceilf(xr - 0.5f);
+        if (x_begin < 0) x_begin = 0;
+        if (x_end > t->width) x_end = t->width;
+        if (x_begin >= x_end) continue;
+
+        float dx = x_begin + 0.5f - p->sx[a], dy = yc - p->sy[a];
+        float ooz = p->ooz[a] + zdx * dx + zdy * dy;
+        float L = p->lum[a] + ldx * dx + ldy * dy;
+        int row = y * t->width;
+        for (int x = x_begin; x < x_end; x++, ooz += zdx, L += ldx) {
+            // Branch-free: the depth test is close to a coin flip
+            int idx = row + x, lum = (int)(L * 8);
+            char ch = L > 0 ? luminance_chars[lum < 11 ? lum : 11] : ' ';
+            float old = t->zbuffer[idx];
+            int closer = ooz > old;
+            t->zbuffer[idx] = closer ? ooz : old;
+            t->output[idx] = closer ? ch : t->output[idx];
+        }
+        if (row + x_begin < span->lo) span->lo = row + x_begin;
+        if (row + x_end > span->hi) span->hi = row + x_end;
+    }
+}
+
+// Worker t rasterizes its contiguous range of triangles into its own tile
+static void raster_worker(void *ctx, int worker, int num_workers) {
+    RenderTask *task = ctx;
+    Tile *tile = &task->tiles[worker];
+    Target t = task->target;
+    t.output = tile->output;
+    t.zbuffer = tile->zbuffer;
+    tile_clear(tile);
+
+    Span written = {t.width * t.height, 0};
+    int begin, end;
+    worker_range(task->mesh.num_triangles, worker, num_workers, &begin, &end);
+    for (int i = begin; i < end; i++) raster_triangle(&t, &task->proj, task->mesh.tri[i], &written);
+    if (written.hi > written.lo) tile->dirty = written;
+}
+
+// Depth-resolves a band of rows into tile 0. Tiles are visited in triangle
+// order and only a strictly nearer sample replaces the current one, so every
+// cell keeps the first of its nearest samples, exactly as a serial pass would.
+static void merge_worker(void *ctx, int worker, int num_workers) {
+    RenderTask *task = ctx;
+    int w = task->target.width, y_begin, y_end;
+    worker_range(task->target.height, worker, num_workers, &y_begin, &y_end);
+    char *output = task->tiles[0].output;
+    float *zbuffer = task->tiles[0].zbuffer;
+    for (int t = 1; t < num_workers; t++) {
+        const char *src_out = task->tiles[t].output;
+        const float *src_z = task->tiles[t].zbuffer;
+        Span d = task->tiles[t].dirty;
+        int begin = d.lo > y_begin * w ? d.lo : y_begin * w, end = d.hi < y_end * w ? d.hi : y_end * w;
+        for (int i = begin; i < end; i++) {
+            int nearer = src_z[i] > zbuffer[i];
+            zbuffer[i] = nearer ? src_z[i] : zbuffer[i];
+            output[i] = nearer ? src_out[i] : output[i];
+        }
+    }
+}
+
+// Points the task at a canvas and its buffers; every tile starts fully dirty.
+// A parametric surface is re-tessellated to suit the new size.
+static void render_resize(RenderTask *task, int num_workers, int width, int height, char *output, float *zbuffer) {
+    size_t cells = (size_t)width * height;
+    task->target = (Target){width, height, width / 2, height / 2, width * K2 * 3 / (8 * (R1 + R2)), NULL, NULL};
+    task->tiles[0] = (Tile){output, zbuffer, cells, {0, (int)cells}};
+    for (int t = 1; t < num_workers; t++) {
+        Tile *tile = &task->tiles[t];
+        if (tile->capacity < cells) {
+            tile->output = xrealloc(tile->output, cells);
+            tile->zbuffer = xrealloc(tile->zbuffer, cells * sizeof(float));
+            tile->capacity = cells;
+        }
+        tile->dirty = (Span){0, (int)cells};
+    }
+
+    if (task->surface) tessellate_for_scale(&task->mesh, task->surface, task->target.K1, &task->nu, &task->nv);
+    projected_reserve(&task->proj, task->mesh.num_vertices);
+}
+
+// Frees the worker tiles, the mesh and the projected vertices; tiles[0]
+// belongs to the caller
+static void render_free(RenderTask *task) {
+    for (int t = 1; t < MAX_THREADS; t++) {
+        free(task->tiles[t].output);
+        free(task->tiles[t].zbuffer);
+    }
+    mesh_free(&task->mesh);
+    free(task->proj.sx);
+    free(task->proj.sy);
+    free(task->proj.ooz);
+    free(task->proj.lum);
+    *task = (RenderTask){0};
+}
+
+// Renders the model as it is t seconds into the animation into tiles[0]
+static void render_frame(WorkerPool *pool, RenderTask *task, double t) {
+    double A = SPEED_A * t, B = SPEED_B * t;
+    float sinA = sin(A), cosA = cos(A), sinB = sin(B), cosB = cos(B);
+    // Rotation by A about x then B about z
+    float m[3][3] = {
+        {cosB, -cosA * sinB, sinA * sinB},
+        {sinB, cosA * cosB, -sinA * cosB},
+        {0, sinA, cosA},
+    };
+    memcpy(task->m, m, sizeof(m));
+
+    pool_run(pool, project_worker, task);
+    pool_run(pool, raster_worker, task);
+    if (pool->num_threads > 1) {
+        pool_run(pool, merge_worker, task);
+        Span *d = &task->tiles[0].dirty;
+        for (int t = 1; t < pool->num_threads; t++) {
+            Span s = task->tiles[t].dirty;
+            if (s.hi <= s.lo) continue;
+            if (d->hi <= d->lo) *d = s;
+            if (s.lo < d->lo) d->lo = s.lo;
+            if (s.hi > d->hi) d->hi = s.hi;
+        }
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_until(double *deadline, double interval) {
+    double now = now_seconds();
+    if (*deadline > now) {
+        double wait = *deadline - now;
+        struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+        nanosleep(&ts, NULL);
+    } else if (now - *deadline > interval) {
+        *deadline = now;
+    }
+    *deadline += interval;
+}
+
+static int run_interactive(WorkerPool *pool, RenderTask *task) {
+    Screen scr = {0};
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_winch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+    // Ctrl-C ends the loop so the buffers are freed on the way out
+    sa.sa_handler = on_quit;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    double start = now_seconds(), next_frame = start;
+    while (!quit) {
+        int clear = resized;
+        if (resized) {
+            resized = 0;
+            screen_resize(&scr);
+            render_resize(task, pool->num_threads, scr.width, scr.height, scr.output, scr.zbuffer);
+        }
+        render_frame(pool, task, now_seconds() - start);
+        screen_present(&scr, clear);
+        sleep_until(&next_frame, 1.0 / FRAME_RATE);
+    }
+    // Leave the prompt below the last frame
+    char bottom[32];
+    write_all(bottom, snprintf(bottom, sizeof(bottom), "\x1b[%d;1H\n", scr.height));
+    free(scr.output);
+    free(scr.shown);
+    free(scr.zbuffer);
+    free(scr.out);
+    return 0;
+}
+
+// Renders frames back to back at a fixed virtual frame rate and writes them as text
+static int run_export(WorkerPool *pool, RenderTask *task, const char *path, int frames, int width, int height, double fps) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    size_t cells = (size_t)width * height;
+    char *output = xrealloc(NULL, cells);
+    float *zbuffer = xrealloc(NULL, cells * sizeof(float));
+    char *text = xrealloc(NULL, cells + height);
+    render_resize(task, pool->num_threads, width, height, output, zbuffer);
+
+    double render_time = 0.0, t_start = now_seconds();
+    for (int k = 0; k < frames; k++) {
+        double t0 = now_seconds();
+        render_frame(pool, task, k / fps);
+        render_time += now_seconds() - t0;
+
+        for (int y = 0; y < height; y++) {
+            memcpy(text + (size_t)y * (width + 1), output + (size_t)y * width, width);
+            text[(size_t)y * (width + 1) + width] = '\n';
+        }
+        if (fwrite(text, 1, cells + height, f) != cells + height) break;
+    }
+    free(output);
+    free(zbuffer);
+    free(text);
+    if (ferror(f) | fclose(f)) {
+        perror(path);
+        return 1;
+    }
+    double elapsed = now_seconds() - t_start;
+
+    printf("exported %d frames of %dx%d to %s  triangles: %d  threads: %d\n",
+           frames, width, height, path, task->mesh.num_triangles, pool->num_threads);
+    printf("elapsed: %.3f s  %.1f frames/s (rendering alone %.1f frames/s)\n",
+           elapsed, elapsed > 0 ? frames / elapsed : 0.0, render_time > 0 ? frames / render_time : 0.0);
     return 0;
 }
+
+int main(int argc, char **argv) {
+    int threads = 1, frames = EXPORT_FRAMES, width = EXPORT_WIDTH, height = EXPORT_HEIGHT;
+    double fps = FRAME_RATE;
+    const char *export_path = NULL, *surface_name = "torus", *obj_path = NULL;
+    static const struct option long_opts[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"export",  required_argument, NULL, 'e'},
+        {"frames",  required_argument, NULL, 'n'},
+        {"width",   required_argument, NULL, 'x'},
+        {"height",  required_argument, NULL, 'y'},
+        {"fps",     required_argument, NULL, 'f'},
+        {"surface", required_argument, NULL, 's'},
+        {"obj",     required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:e:n:x:y:f:s:o:", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 't': threads = atoi(optarg); break;
+            case 'e': export_path = optarg; break;
+            case 'n': frames = atoi(optarg); break;
+            case 'x': width = atoi(optarg); break;
+            case 'y': height = atoi(optarg); break;
+            case 'f': fps = atof(optarg); break;
+            case 's': surface_name = optarg; break;
+            case 'o': obj_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [--surface torus|sphere | --obj FILE] [--threads N]\n"
+                                "       %s --export FILE [--frames N] [--width W] [--height H] [--fps F] [model and thread options]\n",
+                        argv[0], argv[0]);
+                return 1;
+        }
+    }
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (frames < 1) frames = 1;
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
+    if (!(fps > 0)) fps = FRAME_RATE;
+
+    RenderTask task = {0};
+    if (obj_path) {
+        if (mesh_load_obj(&task.mesh, obj_path) != 0) return 1;
+    } else if ((task.surface = find_surface(surface_name)) == NULL) {
+        fprintf(stderr, "Unknown surface '%s' (torus, sphere)\n", surface_name);
+        return 1;
+    }
+
+    WorkerPool *pool = pool_create(threads);
+    int status = export_path ? run_export(pool, &task, export_path, frames, width, height, fps)
+                             : run_interactive(pool, &task);
+    pool_destroy(pool);
+    render_free(&task);
+    return status;
+}
@@ -6,6 +6,17 @@
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <signal.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 //deine gravitational constants for various celestial bodies
 #define G_earth 9.8
@@ -18,6 +29,9 @@
 //scale factor for converting simulation coordinates to screen coordinates
 #define SCALE 2.0
 
+//frames per second of the main loop
+#define FRAME_RATE 60
+
 //forward declaration for the settings menu function
 void valueSet_menu(double *mass, double *drag_coefficient, double *gravity, double *power, int width, int height);
 
@@ -27,42 +41,49 @@ void move_cursor(int x, int y) {
     printf("\033[%d;%dH", y, x);
 }
 
-/***********checks if a key has been pressed in the terminal without blocking return 1 if a key is pressed or 0 otherwise*****************/
-int kbhit(void) {
-    struct termios oldt, newt;
-    int oldf;
-    struct timeval tv = {0L, 0L};
-    fd_set readfds;
-
-    //get current terminal settings
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    //disable canonical mode and echo
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-
-    //check for input
-    FD_ZERO(&readfds);
-    FD_SET(STDIN_FILENO, &readfds);
-    select(STDIN_FILENO + 1, &readfds, NULL, NULL, &tv);
-
-    int hit = FD_ISSET(STDIN_FILENO, &readfds);
-    //restore old terminal settings
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    return hit;
-}
-
-/***************gets a character from the terminal without waiting for the Enter key and return the character code of the key pressed*********************/
-int getch_nonblock(void) {
-    int ch;
-    struct termios oldt, newt;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    ch = getchar();
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    return ch;
+//terminal settings from before raw mode, put back on exit, on fatal signals and around the menu
+static struct termios orig_termios;
+static volatile sig_atomic_t raw_enabled = 0;
+
+/***********switches the terminal to raw input once: keys arrive one by one without echo*****************/
+void raw_mode_enable(void) {
+    struct termios raw;
+    if (raw_enabled || tcgetattr(STDIN_FILENO, &orig_termios) != 0) return;
+    raw = orig_termios;
+    //disable canonical mode and echo; signals (ctrl-c) still work
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0) raw_enabled = 1;
+}
+
+/***********restores the terminal settings; safe to call from a signal handler*****************/
+void raw_mode_disable(void) {
+    if (!raw_enabled) return;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+    raw_enabled = 0;
+}
+
+/***********fatal signal or ctrl-z: give the terminal back before the default action*****************/
+void on_terminal_signal(int sig) {
+    int was_raw = raw_enabled;
+    sigset_t set;
+    raw_mode_disable();
+    signal(sig, SIG_DFL);
+    //the signal is blocked while its handler runs; let the re-raised one through now
+    sigemptyset(&set);
+    sigaddset(&set, sig);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+    raise(sig);
+    //only reached after SIGTSTP, once the program is continued
+    signal(sig, on_terminal_signal);
+    if (was_raw) raw_mode_enable();
+}
+
+void install_terminal_handlers(void) {
+    static const int sigs[] = {SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGTSTP};
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) signal(sigs[i], on_terminal_signal);
+    atexit(raw_mode_disable);
 }
 
 /********************Clears the terminal screen using ANSI escape codes**********************************************/
@@ -70,34 +91,1133 @@ void clear_screen() {
     printf("\033[H\033[J");
 }
 
-int main() {
+/***********physics state of one projectile: position (m) and velocity (m/s)*****************/
+typedef struct {
+    double px, py, vx, vy;
+} State;
+
+/***********physical properties the trajectory depends on*****************/
+typedef struct {
+    double mass;
+    double drag_coefficient;
+    double gravity;
+} Physics;
+
+typedef enum { INTEGRATOR_RK4, INTEGRATOR_RK45, INTEGRATOR_COUNT } Integrator;
+static const char *integrator_names[INTEGRATOR_COUNT] = {"RK4", "RK45"};
+
+//fixed step of the rk4 integrator in simulated seconds
+#define RK4_STEP (1.0 / 240.0)
+//error tolerance per step of the adaptive dormand-prince integrator
+#define RK45_TOL 1e-9
+#define RK45_MAX_STEP 0.5
+//flight_range gives up on trajectories still in the air after this long (no gravity, for one)
+#define FLIGHT_MAX_TIME 1000.0
+
+/***********one trajectory being integrated step by step. the current step covers [t0, t1] and
+ can be sampled anywhere inside it (dense output), so the simulation never depends on the frame rate*****************/
+typedef struct {
+    Integrator integrator;
+    Physics physics;
+    double t0, t1, h_next;
+    State y0, y1;
+    State k[7];          //stage derivatives of the last step; k[0] is the derivative at y0
+    State f1;            //derivative at y1, which is k[0] of the next step
+    long evals;          //force evaluations so far
+    int landed;
+    int diverged;        //the state stopped being finite (no mass, say); landed where it was last finite
+    double t_land;
+    State at_land;
+} Flight;
+
+/***********time derivative of the state: drag against the velocity plus gravity*****************/
+State derivative(const Physics *phys, const State *s) {
+    double speed = sqrt(s->vx*s->vx + s->vy*s->vy);
+    //calculate drag force
+    double force_drag_magnitude = 0.5 * phys->drag_coefficient * speed * speed;
+    double force_drag_x = -force_drag_magnitude * (s->vx / (speed + 1e-9)); //avoid division by zero <3
+    double force_drag_y = -force_drag_magnitude * (s->vy / (speed + 1e-9));
+
+    //net force is drag + gravity, a = f/m
+    State d = {s->vx, s->vy, force_drag_x / phys->mass, (force_drag_y - phys->gravity * phys->mass) / phys->mass};
+    return d;
+}
+
+/***********y + h * sum(b[i] * k[i]) over the first n stages*****************/
+State combine(const State *y, double h, const State *k, const double *b, int n) {
+    State r = *y;
+    for (int i = 0; i < n; i++) {
+        if (b[i] == 0) continue;
+        r.px += h * b[i] * k[i].px;
+        r.py += h * b[i] * k[i].py;
+        r.vx += h * b[i] * k[i].vx;
+        r.vy += h * b[i] * k[i].vy;
+    }
+    return r;
+}
+
+/***********classic fourth order runge-kutta step of length h from y0 (k[0] already set)*****************/
+void rk4_step(Flight *f, double h) {
+    static const double a2[] = {0.5}, a3[] = {0, 0.5}, a4[] = {0, 0, 1}, b[] = {1.0/6, 1.0/3, 1.0/3, 1.0/6};
+    State s;
+    s = combine(&f->y0, h, f->k, a2, 1); f->k[1] = derivative(&f->physics, &s);
+    s = combine(&f->y0, h, f->k, a3, 2); f->k[2] = derivative(&f->physics, &s);
+    s = combine(&f->y0, h, f->k, a4, 3); f->k[3] = derivative(&f->physics, &s);
+    f->y1 = combine(&f->y0, h, f->k, b, 4);
+    f->f1 = derivative(&f->physics, &f->y1);
+    f->evals += 4;
+    f->t1 = f->t0 + h;
+}
+
+//dormand-prince 5(4) tableau
+static const double dp_a[7][6] = {
+    {0},
+    {1.0/5},
+    {3.0/40, 9.0/40},
+    {44.0/45, -56.0/15, 32.0/9},
+    {19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729},
+    {9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656},
+    {35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84},
+};
+//difference between the fifth and fourth order weights, for the error estimate
+static const double dp_e[7] = {71.0/57600, 0, -71.0/16695, 71.0/1920, -17253.0/339200, 22.0/525, -1.0/40};
+//weights of the continuous extension (hairer, norsett & wanner)
+static const double dp_d[7] = {-12715105075.0/11282082432, 0, 87487479700.0/32700410799, -10690763975.0/1880347072,
+                               701980252875.0/199316789632, -1453857185.0/822651844, 69997945.0/29380423};
+
+/***********adaptive dormand-prince step from y0 (k[0] already set): retries with a smaller step
+ until the local error is within RK45_TOL, then proposes the next step length*****************/
+void rk45_step(Flight *f) {
+    double h = f->h_next;
+    for (;;) {
+        State s;
+        for (int i = 1; i < 7; i++) {
+            s = combine(&f->y0, h, f->k, dp_a[i], i);
+            f->k[i] = derivative(&f->physics, &s);
+        }
+        f->evals += 6;
+        //the last stage is evaluated at the fifth order solution (first same as last)
+        State err = combine(&(State){0, 0, 0, 0}, h, f->k, dp_e, 7);
+        double y0v[4] = {f->y0.px, f->y0.py, f->y0.vx, f->y0.vy};
+        double y1v[4] = {s.px, s.py, s.vx, s.vy};
+        double ev[4] = {err.px, err.py, err.vx, err.vy};
+        double norm = 0;
+        for (int i = 0; i < 4; i++) {
+            double sc = RK45_TOL * (1 + fmax(fabs(y0v[i]), fabs(y1v[i])));
+            norm += (ev[i] / sc) * (ev[i] / sc);
+        }
+        norm = sqrt(norm / 4);
+        if (!isfinite(norm)) {
+            //no step length makes a non-finite derivative acceptable: hand it to flight_step
+            f->y1 = s;
+            f->f1 = f->k[6];
+            f->t1 = f->t0 + h;
+            f->h_next = h;
+            return;
+        }
+        double factor = norm > 0 ? 0.9 * pow(norm, -0.2) : 5;
+        factor = fmin(5, fmax(0.2, factor));
+        if (norm <= 1) {
+            f->y1 = s;
+            f->f1 = f->k[6];
+            f->t1 = f->t0 + h;
+            f->h_next = fmin(h * factor, RK45_MAX_STEP);
+            return;
+        }
+        h *= factor;
+    }
+}
+
+/***********cubic hermite through y0, y1 with derivatives d0, d1 over a step of length h, at fraction th of it*****************/
+double hermite(double y0, double d0, double y1, double d1, double h, double th) {
+    double th1 = 1 - th;
+    return (1 + 2 * th) * th1 * th1 * y0 + th * th1 * th1 * h * d0 + th * th * (3 - 2 * th) * y1 - th * th * th1 * h * d1;
+}
+
+/***********state at time t inside the current step [t0, t1]*****************/
+State flight_sample(const Flight *f, double t) {
+    double h = f->t1 - f->t0;
+    double th = h > 0 ? (t - f->t0) / h : 0, th1 = 1 - th;
+    const double *y0 = &f->y0.px, *y1 = &f->y1.px, *k0 = &f->k[0].px, *f1 = &f->f1.px;
+    State out;
+    double *o = &out.px;
+    for (int i = 0; i < 4; i++) {
+        if (f->integrator == INTEGRATOR_RK45) {
+            //fourth order continuous extension of dormand-prince
+            double ydiff = y1[i] - y0[i];
+            double bspl = h * k0[i] - ydiff;
+            double r5 = 0;
+            for (int j = 0; j < 7; j++) r5 += dp_d[j] * (&f->k[j].px)[i];
+            r5 *= h;
+            o[i] = y0[i] + th * (ydiff + th1 * (bspl + th * (ydiff - h * f1[i] - bspl + th1 * r5)));
+        } else {
+            o[i] = hermite(y0[i], k0[i], y1[i], f1[i], h, th);
+        }
+    }
+    return out;
+}
+
+/***********starts a trajectory at t = 0 from state s*****************/
+void flight_start(Flight *f, Integrator integrator, const Physics *phys, State s) {
+    memset(f, 0, sizeof(*f));
+    f->integrator = integrator;
+    f->physics = *phys;
+    f->y0 = f->y1 = s;
+    f->k[0] = f->f1 = derivative(phys, &s);
+    f->evals = 1;
+    f->h_next = 0.01;
+}
+
+/***********height of a flight at time t, for ground_time*****************/
+double flight_height(const void *ctx, double t) {
+    return flight_sample(ctx, t).py;
+}
+
+/***********time in [t0, t1] at which height(t) comes down through zero, given that it ends
+ the interval at y1 < 0 having started it at y0*****************/
+double ground_time(double (*height)(const void *ctx, double t), const void *ctx, double t0, double t1, double y0, double y1) {
+    double ta = t0, tb = t1, ya = y0, yb = y1;
+    if (ya <= 0) {
+        //launched from the ground in this step: bracket from the last sample above it
+        for (int i = 15; i >= 1; i--) {
+            double t = t0 + (t1 - t0) * i / 16;
+            double y = height(ctx, t);
+            if (y > 0) {
+                ta = t;
+                ya = y;
+                break;
+            }
+        }
+    }
+    double t = ta;
+    if (ya > 0) {
+        //illinois regula falsi
+        int side = 0;
+        for (int i = 0; i < 100; i++) {
+            t = (ta * yb - tb * ya) / (yb - ya);
+            double y = height(ctx, t);
+            if (fabs(y) < 1e-12 || tb - ta < 1e-13 * (1 + tb)) break;
+            if (y > 0) {
+                ta = t; ya = y;
+                if (side == -1) yb /= 2;
+                side = -1;
+            } else {
+                tb = t; yb = y;
+                if (side == 1) ya /= 2;
+                side = 1;
+            }
+        }
+    }
+    return t;
+}
+
+/***********takes one step; if the projectile goes below the ground during it, finds the exact
+ moment of impact on the dense output and marks the flight as landed*****************/
+void flight_step(Flight *f) {
+    if (f->landed) return;
+    //continue from the end of the last step
+    f->t0 = f->t1;
+    f->y0 = f->y1;
+    f->k[0] = f->f1;
+    if (f->integrator == INTEGRATOR_RK45) rk45_step(f);
+    else rk4_step(f, RK4_STEP);
+    if (!isfinite(f->y1.px) || !isfinite(f->y1.py)) {
+        f->landed = f->diverged = 1;
+        f->t_land = f->t0;
+        f->at_land = f->y0;
+        f->t1 = f->t0;
+        f->y1 = f->y0;
+        return;
+    }
+    if (f->y1.py >= 0) return;
+
+    double t = ground_time(flight_height, f, f->t0, f->t1, f->y0.py, f->y1.py);
+    f->landed = 1;
+    f->t_land = t;
+    f->at_land = flight_sample(f, t);
+    f->at_land.py = 0;
+}
+
+/***********integrates a whole trajectory and returns where it comes down (NAN if it does not
+ within FLIGHT_MAX_TIME)*****************/
+double flight_range(Integrator integrator, const Physics *phys, State s, long *evals) {
+    Flight f;
+    flight_start(&f, integrator, phys, s);
+    while (!f.landed && f.t1 < FLIGHT_MAX_TIME) flight_step(&f);
+    if (evals) *evals = f.evals;
+    return f.landed && !f.diverged ? f.at_land.px : NAN;
+}
+
+//--------------------------------batch solver for monte carlo dispersion--------------------------------
+
+//simd lanes of doubles: the batch kernel below is written once against these
+#if defined(__AVX__)
+typedef __m256d vdouble;
+#define VW 4
+#define v_set(x) _mm256_set1_pd(x)
+#define v_load(p) _mm256_loadu_pd(p)
+#define v_store(p, a) _mm256_storeu_pd(p, a)
+#define v_add _mm256_add_pd
+#define v_sub _mm256_sub_pd
+#define v_mul _mm256_mul_pd
+#define v_div _mm256_div_pd
+#define v_sqrt _mm256_sqrt_pd
+#define v_below_zero(a) _mm256_movemask_pd(_mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_LT_OQ))
+#elif defined(__SSE2__)
+typedef __m128d vdouble;
+#define VW 2
+#define v_set(x) _mm_set1_pd(x)
+#define v_load(p) _mm_loadu_pd(p)
+#define v_store(p, a) _mm_storeu_pd(p, a)
+#define v_add _mm_add_pd
+#define v_sub _mm_sub_pd
+#define v_mul _mm_mul_pd
+#define v_div _mm_div_pd
+#define v_sqrt _mm_sqrt_pd
+#define v_below_zero(a) _mm_movemask_pd(_mm_cmplt_pd(a, _mm_setzero_pd()))
+#else
+typedef double vdouble;
+#define VW 1
+#define v_set(x) (x)
+#define v_load(p) (*(p))
+#define v_store(p, a) (*(p) = (a))
+#define v_add(a, b) ((a) + (b))
+#define v_sub(a, b) ((a) - (b))
+#define v_mul(a, b) ((a) * (b))
+#define v_div(a, b) ((a) / (b))
+#define v_sqrt sqrt
+#define v_below_zero(a) ((a) < 0)
+#endif
+
+//trajectories in flight at once per thread; several vectors hide the latency of sqrt and div
+#define BATCH_LANES (4 * VW)
+//trajectories still in the air after this long are reported as not landed
+#define BATCH_MAX_TIME FLIGHT_MAX_TIME
+#define MAX_THREADS 64
+
+/***********launch parameters and their random spread: every shot draws mass, drag and power
+ as mean * (1 + sd * normal) and the angle as mean + sd * normal*****************/
+typedef struct {
+    double speed;            //m/s before the power multiplier
+    double angle;            //radians
+    double mass, drag_coefficient, power, gravity;
+    double sd_mass, sd_drag, sd_power; //relative
+    double sd_angle;         //radians
+    uint64_t seed;
+} Dispersion;
+
+/***********lanes of the batch integrator, structure of arrays. a lane holds one trajectory
+ until it lands and is then refilled with the next one*****************/
+typedef struct {
+    double px[BATCH_LANES], py[BATCH_LANES], vx[BATCH_LANES], vy[BATCH_LANES];
+    double ax[BATCH_LANES], ay[BATCH_LANES];     //acceleration at the current state
+    double kd[BATCH_LANES], g[BATCH_LANES];      //drag per unit mass (0.5 * cd / m) and gravity
+    double t[BATCH_LANES];
+    //state at the start of the last step, for finding the moment of impact
+    double px0[BATCH_LANES], py0[BATCH_LANES], vx0[BATCH_LANES], vy0[BATCH_LANES], ax0[BATCH_LANES], ay0[BATCH_LANES];
+    long shot[BATCH_LANES];                      //trajectory in the lane, -1 if idle
+} Lanes;
+
+typedef struct {
+    const Dispersion *d;
+    double *distances;
+    long begin, end;
+} BatchJob;
+
+/***********splitmix64: the random numbers of shot i depend only on the seed and i, so results do
+ not change with the number of threads*****************/
+uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/***********two independent standard normal numbers (box-muller)*****************/
+void normal_pair(uint64_t *state, double *a, double *b) {
+    double u1 = ((splitmix64(state) >> 11) + 1.0) / 9007199254740993.0; //(0, 1]
+    double u2 = (splitmix64(state) >> 11) / 9007199254740992.0;
+    double r = sqrt(-2 * log(u1));
+    *a = r * cos(2 * M_PI * u2);
+    *b = r * sin(2 * M_PI * u2);
+}
+
+/***********puts shot i into lane l with its randomized parameters*****************/
+void lane_load(Lanes *ln, int l, const Dispersion *d, long i) {
+    uint64_t rng = d->seed ^ ((uint64_t)i * 0xD1B54A32D192ED03ull);
+    double n_mass, n_drag, n_power, n_angle;
+    normal_pair(&rng, &n_mass, &n_drag);
+    normal_pair(&rng, &n_power, &n_angle);
+    double mass = fmax(1e-6, d->mass * (1 + d->sd_mass * n_mass));
+    double drag = fmax(0.0, d->drag_coefficient * (1 + d->sd_drag * n_drag));
+    double power = fmax(0.0, d->power * (1 + d->sd_power * n_power));
+    double angle = d->angle + d->sd_angle * n_angle;
+    double v0 = d->speed * power;
+
+    ln->shot[l] = i;
+    ln->px[l] = ln->py[l] = ln->t[l] = 0;
+    ln->vx[l] = v0 * cos(angle);
+    ln->vy[l] = v0 * sin(angle);
+    ln->kd[l] = 0.5 * drag / mass;
+    ln->g[l] = d->gravity;
+    double speed = sqrt(ln->vx[l] * ln->vx[l] + ln->vy[l] * ln->vy[l]);
+    double c = ln->kd[l] * speed * speed / (speed + 1e-9);
+    ln->ax[l] = -c * ln->vx[l];
+    ln->ay[l] = -c * ln->vy[l] - ln->g[l];
+}
+
+/***********parks lane l: no trajectory, no forces, and high enough to never land*****************/
+void lane_idle(Lanes *ln, int l) {
+    ln->shot[l] = -1;
+    ln->px[l] = ln->vx[l] = ln->vy[l] = ln->ax[l] = ln->ay[l] = ln->kd[l] = ln->g[l] = ln->t[l] = 0;
+    ln->py[l] = 1;
+}
+
+/***********acceleration from drag and gravity; it depends only on the velocity*****************/
+static inline void v_accel(vdouble vx, vdouble vy, vdouble kd, vdouble g, vdouble *ax, vdouble *ay) {
+    vdouble speed = v_sqrt(v_add(v_mul(vx, vx), v_mul(vy, vy)));
+    vdouble c = v_div(v_mul(kd, v_mul(speed, speed)), v_add(speed, v_set(1e-9)));
+    *ax = v_sub(v_set(0), v_mul(c, vx));
+    *ay = v_sub(v_set(0), v_add(v_mul(c, vy), g));
+}
+
+/***********one rk4 step of RK4_STEP for every lane, the same scheme as rk4_step. returns a bit
+ mask of the lanes that are below the ground afterwards*****************/
+int lanes_step(Lanes *ln) {
+    const double h = RK4_STEP;
+    vdouble vh = v_set(h), vh2 = v_set(h / 2), vh6 = v_set(h / 6), two = v_set(2);
+    int below = 0;
+    for (int l = 0; l < BATCH_LANES; l += VW) {
+        vdouble px = v_load(ln->px + l), py = v_load(ln->py + l), vx = v_load(ln->vx + l), vy = v_load(ln->vy + l);
+        vdouble ax1 = v_load(ln->ax + l), ay1 = v_load(ln->ay + l), kd = v_load(ln->kd + l), g = v_load(ln->g + l);
+        v_store(ln->px0 + l, px); v_store(ln->py0 + l, py);
+        v_store(ln->vx0 + l, vx); v_store(ln->vy0 + l, vy);
+        v_store(ln->ax0 + l, ax1); v_store(ln->ay0 + l, ay1);
+
+        vdouble vx2 = v_add(vx, v_mul(vh2, ax1)), vy2 = v_add(vy, v_mul(vh2, ay1)), ax2, ay2;
+        v_accel(vx2, vy2, kd, g, &ax2, &ay2);
+        vdouble vx3 = v_add(vx, v_mul(vh2, ax2)), vy3 = v_add(vy, v_mul(vh2, ay2)), ax3, ay3;
+        v_accel(vx3, vy3, kd, g, &ax3, &ay3);
+        vdouble vx4 = v_add(vx, v_mul(vh, ax3)), vy4 = v_add(vy, v_mul(vh, ay3)), ax4, ay4;
+        v_accel(vx4, vy4, kd, g, &ax4, &ay4);
+
+        px = v_add(px, v_mul(vh6, v_add(v_add(vx, vx4), v_mul(two, v_add(vx2, vx3)))));
+        py = v_add(py, v_mul(vh6, v_add(v_add(vy, vy4), v_mul(two, v_add(vy2, vy3)))));
+        vx = v_add(vx, v_mul(vh6, v_add(v_add(ax1, ax4), v_mul(two, v_add(ax2, ax3)))));
+        vy = v_add(vy, v_mul(vh6, v_add(v_add(ay1, ay4), v_mul(two, v_add(ay2, ay3)))));
+        v_accel(vx, vy, kd, g, &ax1, &ay1);
+
+        v_store(ln->px + l, px); v_store(ln->py + l, py);
+        v_store(ln->vx + l, vx); v_store(ln->vy + l, vy);
+        v_store(ln->ax + l, ax1); v_store(ln->ay + l, ay1);
+        v_store(ln->t + l, v_add(v_load(ln->t + l), vh));
+        below |= v_below_zero(py) << l;
+    }
+    return below;
+}
+
+/***********last step of one lane, for ground_time*****************/
+typedef struct {
+    const Lanes *ln;
+    int l;
+} LaneStep;
+
+double lane_height(const void *ctx, double t) {
+    const LaneStep *s = ctx;
+    const Lanes *ln = s->ln;
+    return hermite(ln->py0[s->l], ln->vy0[s->l], ln->py[s->l], ln->vy[s->l], RK4_STEP, t);
+}
+
+/***********integrates shots [begin, end) and stores where each comes down (NAN if it never does)*****************/
+void *batch_worker(void *arg) {
+    BatchJob *job = arg;
+    Lanes ln;
+    long next = job->begin;
+    int active = 0;
+    for (int l = 0; l < BATCH_LANES; l++) {
+        if (next < job->end) {
+            lane_load(&ln, l, job->d, next++);
+            active++;
+        } else {
+            lane_idle(&ln, l);
+        }
+    }
+
+    for (long step = 1; active > 0; step++) {
+        int below = lanes_step(&ln);
+        //the time limit and a state gone non-finite (NaN never compares below zero, no mass for
+        //one) are rare, so they are checked only every few hundred steps
+        if (step % 256 == 0) {
+            for (int l = 0; l < BATCH_LANES; l++)
+                if (ln.shot[l] >= 0 && (ln.t[l] > BATCH_MAX_TIME || !isfinite(ln.px[l]) || !isfinite(ln.py[l]))) below |= 1 << l;
+        }
+        while (below) {
+            int l = __builtin_ctz(below);
+            below &= below - 1;
+            if (ln.shot[l] < 0) continue;
+
+            double dist = NAN;
+            if (ln.py[l] < 0 && isfinite(ln.py[l]) && isfinite(ln.px[l])) {
+                //impact inside the last step, found on the hermite interpolant like flight_sample does
+                LaneStep st = {&ln, l};
+                double th = ground_time(lane_height, &st, 0, 1, ln.py0[l], ln.py[l]);
+                dist = hermite(ln.px0[l], ln.vx0[l], ln.px[l], ln.vx[l], RK4_STEP, th);
+            }
+            job->distances[ln.shot[l]] = dist;
+            if (next < job->end) {
+                lane_load(&ln, l, job->d, next++);
+            } else {
+                lane_idle(&ln, l);
+                active--;
+            }
+        }
+    }
+    return NULL;
+}
+
+/***********landing distance of n randomized shots, split over the given number of threads*****************/
+void dispersion_run(const Dispersion *d, long n, int threads, double *distances) {
+    pthread_t tid[MAX_THREADS];
+    BatchJob jobs[MAX_THREADS];
+    int started[MAX_THREADS] = {0};
+    long chunk = (n + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        long begin = t * chunk, end = begin + chunk;
+        jobs[t] = (BatchJob){d, distances, begin < n ? begin : n, end < n ? end : n};
+        if (t > 0) started[t] = pthread_create(&tid[t], NULL, batch_worker, &jobs[t]) == 0;
+    }
+    //chunks whose thread could not be started are run here
+    for (int t = 0; t < threads; t++)
+        if (!started[t]) batch_worker(&jobs[t]);
+    for (int t = 1; t < threads; t++)
+        if (started[t]) pthread_join(tid[t], NULL);
+}
+
+int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/***********value below which a fraction q of the sorted values lie (linear interpolation)*****************/
+double percentile(const double *sorted, long n, double q) {
+    double pos = q * (n - 1);
+    long i = (long)pos;
+    if (i >= n - 1) return sorted[n - 1];
+    return sorted[i] + (pos - i) * (sorted[i + 1] - sorted[i]);
+}
+
+/***********counts the values into bins equal-width bins over [lo, hi]*****************/
+void histogram(const double *values, long n, double lo, double hi, long *counts, int bins) {
+    memset(counts, 0, bins * sizeof(long));
+    double scale = hi > lo ? bins / (hi - lo) : 0;
+    for (long i = 0; i < n; i++) {
+        int b = (int)((values[i] - lo) * scale);
+        counts[b < 0 ? 0 : b >= bins ? bins - 1 : b]++;
+    }
+}
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//--------------------------------inverse targeting--------------------------------
+
+//range table grid: speeds uniform in log(1 + (v / terminal speed)^2), which is fine where drag
+//starts to matter and coarse where the scaled range barely changes; angles every degree
+#define TABLE_SPEEDS 97
+#define TABLE_ANGLES 91
+#define TABLE_MAGIC 0x32544E52u //"RNT2"
+//the table covers speeds up to this many terminal speeds; past it, range grows only slowly
+#define TABLE_TOP_TERMINAL 1000.0
+
+/***********landing distance for launch speed and angle on a grid, for one set of physics.
+ ranges are stored divided by v^2 / g, the drag-free range scale, and speeds are in terminal
+ speeds, so the table depends on the physics alone. built on first use, then kept in memory and on disk*****************/
+typedef struct {
+    uint32_t magic;
+    int speeds, angles;
+    double key[3];           //mass, drag coefficient, gravity
+    double terminal_speed;
+    double range[TABLE_SPEEDS][TABLE_ANGLES]; //range * g / v^2
+} RangeTable;
+
+/***********a launch angle that hits the target, or none*****************/
+typedef struct {
+    int low_ok, high_ok;
+    double low, high;        //radians
+    double max_range;        //at this speed
+} AimSolution;
+
+/***********the table needs every shot to come back down: without gravity they never do,
+ without mass the acceleration is not defined, and negative drag runs away*****************/
+int physics_aimable(const Physics *phys) {
+    return phys->mass > 0 && phys->gravity > 0 && phys->drag_coefficient >= 0;
+}
+
+/***********speed at which drag balances gravity, the speed unit of the table. without drag the
+ scaled range does not depend on the speed at all, so any unit will do*****************/
+double terminal_speed(const Physics *phys) {
+    if (phys->drag_coefficient <= 0) return 1.0;
+    return sqrt(2 * phys->mass * phys->gravity / phys->drag_coefficient);
+}
+
+double table_speed(const RangeTable *tab, int i) {
+    double top = log1p(TABLE_TOP_TERMINAL * TABLE_TOP_TERMINAL);
+    return tab->terminal_speed * sqrt(expm1(top * i / (TABLE_SPEEDS - 1)));
+}
+
+double table_angle(int j) {
+    return (M_PI / 2) * j / (TABLE_ANGLES - 1);
+}
+
+/***********cache file of a table: the key is hashed into the name (fnv-1a)*****************/
+int table_path(const double *key, char *path, size_t size) {
+    const char *home = getenv("HOME");
+    if (home == NULL || *home == '\0') return 0;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const unsigned char *bytes = (const unsigned char *)key;
+    for (size_t i = 0; i < 3 * sizeof(double); i++) hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    snprintf(path, size, "%s/.cache", home);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) return 0;
+    snprintf(path, size, "%s/.cache/projectile-range-%016llx.bin", home, (unsigned long long)hash);
+    return 1;
+}
+
+/***********reads a table from disk if it is there and matches the key exactly*****************/
+int table_load(RangeTable *tab, const double *key) {
+    char path[4096];
+    if (!table_path(key, path, sizeof(path))) return 0;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return 0;
+    int ok = fread(tab, sizeof(*tab), 1, f) == 1 && tab->magic == TABLE_MAGIC &&
+             tab->speeds == TABLE_SPEEDS && tab->angles == TABLE_ANGLES && memcmp(tab->key, key, sizeof(tab->key)) == 0;
+    fclose(f);
+    return ok;
+}
+
+/***********writes a table next to the others; a failure only costs a rebuild next time*****************/
+void table_save(const RangeTable *tab) {
+    char path[4096], tmp[4160];
+    if (!table_path(tab->key, path, sizeof(path))) return;
+    //write then rename, so a reader never sees half a file
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL) return;
+    int ok = fwrite(tab, sizeof(*tab), 1, f) == 1;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) remove(tmp);
+}
+
+/***********the table for these physics: from memory, else from disk, else integrated now
+ with rk45. only meaningful for physics_aimable ones*****************/
+const RangeTable *range_table(RangeTable *tab, const Physics *phys) {
+    double key[3] = {phys->mass, phys->drag_coefficient, phys->gravity};
+    if (tab->magic == TABLE_MAGIC && memcmp(tab->key, key, sizeof(key)) == 0) return tab;
+    if (table_load(tab, key)) return tab;
+
+    tab->magic = TABLE_MAGIC;
+    tab->speeds = TABLE_SPEEDS;
+    tab->angles = TABLE_ANGLES;
+    memcpy(tab->key, key, sizeof(key));
+    tab->terminal_speed = terminal_speed(phys);
+    for (int i = 0; i < TABLE_SPEEDS; i++) {
+        double v = table_speed(tab, i);
+        for (int j = 0; j < TABLE_ANGLES; j++) {
+            double a = table_angle(j);
+            //at zero speed drag vanishes and the scaled range is that of the vacuum, sin(2a)
+            tab->range[i][j] = i == 0 ? sin(2 * a)
+                             : flight_range(INTEGRATOR_RK45, phys, (State){0, 0, v * cos(a), v * sin(a)}, NULL) * phys->gravity / (v * v);
+        }
+    }
+    table_save(tab);
+    return tab;
+}
+
+/***********range at speed v for every table angle, interpolated along the speed grid. past the top
+ speed the top row is scaled up, which overestimates a little; solve_aim's refinement checks its bracket*****************/
+void table_ranges(const RangeTable *tab, double v, double *r) {
+    double u = v / tab->terminal_speed;
+    double pos = log1p(u * u) / log1p(TABLE_TOP_TERMINAL * TABLE_TOP_TERMINAL) * (TABLE_SPEEDS - 1);
+    if (pos > TABLE_SPEEDS - 1) pos = TABLE_SPEEDS - 1;
+    int i = (int)pos;
+    if (i >= TABLE_SPEEDS - 1) i = TABLE_SPEEDS - 2;
+    double w = pos - i, scale = v * v / tab->key[2];
+    for (int j = 0; j < TABLE_ANGLES; j++) r[j] = ((1 - w) * tab->range[i][j] + w * tab->range[i + 1][j]) * scale;
+}
+
+/***********landing distance of a launch at speed v and angle a, on the rk45 integrator*****************/
+double aim_range(const Physics *phys, double v, double a) {
+    return flight_range(INTEGRATOR_RK45, phys, (State){0, 0, v * cos(a), v * sin(a)}, NULL);
+}
+
+/***********angle in [a, b] at which the range peaks (golden section search), and that range*****************/
+double aim_apex(const Physics *phys, double v, double a, double b, double *apex) {
+    const double g = (sqrt(5.0) - 1) / 2;
+    double c = b - g * (b - a), d = a + g * (b - a);
+    double fc = aim_range(phys, v, c), fd = aim_range(phys, v, d);
+    while (b - a > 1e-10) {
+        if (fc > fd) {
+            b = d; d = c; fd = fc;
+            c = b - g * (b - a);
+            fc = aim_range(phys, v, c);
+        } else {
+            a = c; c = d; fc = fd;
+            d = a + g * (b - a);
+            fd = aim_range(phys, v, d);
+        }
+    }
+    *apex = fc > fd ? c : d;
+    return fmax(fc, fd);
+}
+
+/***********low and high arc angles that land at distance target when launched at speed v.
+ the table brackets each root within a degree and interpolates it. with refine, the answer comes
+ from the rk45 integrator instead: the true apex is found first, each arc is then bracketed between
+ it and an angle that falls short, and polished by illinois regula falsi. an arc whose root is not
+ found to within RANGE_TOL is reported as no solution*****************/
+#define RANGE_TOL 1e-6
+AimSolution solve_aim(const RangeTable *tab, const Physics *phys, double v, double target, int refine) {
+    double r[TABLE_ANGLES];
+    table_ranges(tab, v, r);
+    int top = 0;
+    for (int j = 1; j < TABLE_ANGLES; j++) if (r[j] > r[top]) top = j;
+
+    AimSolution sol = {0, 0, 0, 0, r[top]};
+    double apex = table_angle(top);
+    if (refine) {
+        //the table peak is within a degree of the true one, but its height is interpolated
+        int lo = top > 0 ? top - 1 : 0, hi = top < TABLE_ANGLES - 1 ? top + 1 : top;
+        sol.max_range = aim_apex(phys, v, table_angle(lo), table_angle(hi), &apex);
+    }
+    if (target < 0 || target > sol.max_range) return sol;
+    for (int arc = 0; arc < 2; arc++) {
+        double angle;
+        if (refine) {
+            //step out from the apex a degree at a time until the shot falls short; at 0 and 90
+            //degrees the range is about 0, so this ends
+            double step = table_angle(1), out = apex, fo = sol.max_range - target;
+            while (fo > 0 && (arc == 0 ? out > 0 : out < M_PI / 2)) {
+                out = arc == 0 ? fmax(0, out - step) : fmin(M_PI / 2, out + step);
+                fo = aim_range(phys, v, out) - target;
+            }
+            double ta = out, fa = fo, tb = apex, fb = sol.max_range - target;
+            double fm = fa;
+            angle = ta;
+            if (fb == 0) {
+                angle = apex;
+                fm = 0;
+            } else if (fa * fb < 0) {
+                int side = 0;
+                for (int it = 0; it < 60; it++) {
+                    angle = (ta * fb - tb * fa) / (fb - fa);
+                    fm = aim_range(phys, v, angle) - target;
+                    if (fabs(fm) < 1e-9 * (1 + target) || fabs(tb - ta) < 1e-12) break;
+                    if ((fm > 0) == (fa > 0)) {
+                        ta = angle; fa = fm;
+                        if (side == -1) fb /= 2;
+                        side = -1;
+                    } else {
+                        tb = angle; fb = fm;
+                        if (side == 1) fa /= 2;
+                        side = 1;
+                    }
+                }
+            }
+            if (!(fabs(fm) <= RANGE_TOL * (1 + target))) continue;
+        } else {
+            //range rises with the angle up to the top, then falls
+            int j = -1;
+            if (arc == 0) {
+                for (int k = 0; k < top; k++) if (r[k] <= target && target <= r[k + 1]) { j = k; break; }
+            } else {
+                for (int k = top; k < TABLE_ANGLES - 1; k++) if (r[k] >= target && target >= r[k + 1]) { j = k; break; }
+            }
+            if (j < 0) {
+                if (target != r[top]) continue;
+                j = top < TABLE_ANGLES - 1 ? top : top - 1;
+            }
+            double ta = table_angle(j), tb = table_angle(j + 1);
+            double fa = r[j] - target, fb = r[j + 1] - target;
+            angle = fb != fa ? ta + (tb - ta) * fa / (fa - fb) : ta;
+        }
+        if (arc == 0) {
+            sol.low_ok = 1;
+            sol.low = angle;
+        } else {
+            sol.high_ok = 1;
+            sol.high = angle;
+        }
+    }
+    return sol;
+}
+
+/***********command line mode: --target DIST prints the launch angles that land at DIST*****************/
+int solve_main(const Dispersion *d, double target) {
+    Physics phys = {d->mass, d->drag_coefficient, d->gravity};
+    double v = d->speed * d->power;
+    static RangeTable tab;
+    if (!physics_aimable(&phys)) {
+        fprintf(stderr, "--target needs a positive mass and gravity and a drag of at least 0\n");
+        return 1;
+    }
+    double t0 = now_seconds();
+    range_table(&tab, &phys);
+    double t1 = now_seconds();
+    AimSolution quick = solve_aim(&tab, &phys, v, target, 0);
+    double t2 = now_seconds();
+    AimSolution sol = solve_aim(&tab, &phys, v, target, 1);
+    double t3 = now_seconds();
+
+    printf("target %.3f m at %.2f m/s (mass %.2f kg, drag %.2f, G %.2f): max range %.3f m\n",
+           target, v, phys.mass, phys.drag_coefficient, phys.gravity, sol.max_range);
+    const char *names[2] = {"low arc ", "high arc"};
+    int ok[2] = {sol.low_ok, sol.high_ok};
+    double table_angle_[2] = {quick.low, quick.high}, angle[2] = {sol.low, sol.high};
+    for (int k = 0; k < 2; k++) {
+        if (!ok[k]) {
+            printf("  %s  out of range\n", names[k]);
+            continue;
+        }
+        double hit = aim_range(&phys, v, angle[k]);
+        char from_table[32] = "table: none";
+        if (k == 0 ? quick.low_ok : quick.high_ok) snprintf(from_table, sizeof(from_table), "table %.6f deg", table_angle_[k] * 180 / M_PI);
+        printf("  %s  %.6f deg (%s)  lands at %.6f m\n", names[k], angle[k] * 180 / M_PI, from_table, hit);
+    }
+    printf("table %.1f ms (built or loaded) | table query %.2f us | refined query %.2f ms\n",
+           (t1 - t0) * 1e3, (t2 - t1) * 1e6, (t3 - t2) * 1e3);
+    return 0;
+}
+
+/***********command line mode: --dispersion N runs N randomized shots and prints the spread of
+ their landing distances*****************/
+int batch_main(int argc, char **argv) {
+    Dispersion d = {20.0, 45 * M_PI / 180, 1.0, 0.47, 1.0, G_earth, 0.05, 0.10, 0.05, 1 * M_PI / 180, 1};
+    long shots = 0;
+    int threads = 0, bins = 20;
+    double target = -1;
+    static const struct option long_opts[] = {
+        {"dispersion", required_argument, NULL, 'n'},
+        {"speed",      required_argument, NULL, 'v'},
+        {"angle",      required_argument, NULL, 'a'},
+        {"mass",       required_argument, NULL, 'm'},
+        {"drag",       required_argument, NULL, 'c'},
+        {"power",      required_argument, NULL, 'p'},
+        {"gravity",    required_argument, NULL, 'g'},
+        {"sd-mass",    required_argument, NULL, 'M'},
+        {"sd-drag",    required_argument, NULL, 'C'},
+        {"sd-power",   required_argument, NULL, 'P'},
+        {"sd-angle",   required_argument, NULL, 'A'},
+        {"seed",       required_argument, NULL, 's'},
+        {"threads",    required_argument, NULL, 't'},
+        {"bins",       required_argument, NULL, 'b'},
+        {"target",     required_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:v:a:m:c:p:g:M:C:P:A:s:t:b:T:", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'n': shots = atol(optarg); break;
+            case 'v': d.speed = atof(optarg); break;
+            case 'a': d.angle = atof(optarg) * M_PI / 180; break;
+            case 'm': d.mass = atof(optarg); break;
+            case 'c': d.drag_coefficient = atof(optarg); break;
+            case 'p': d.power = atof(optarg); break;
+            case 'g': d.gravity = atof(optarg); break;
+            case 'M': d.sd_mass = atof(optarg) / 100; break;
+            case 'C': d.sd_drag = atof(optarg) / 100; break;
+            case 'P': d.sd_power = atof(optarg) / 100; break;
+            case 'A': d.sd_angle = atof(optarg) * M_PI / 180; break;
+            case 's': d.seed = strtoull(optarg, NULL, 0); break;
+            case 't': threads = atoi(optarg); break;
+            case 'b': bins = atoi(optarg); break;
+            case 'T': target = atof(optarg); break;
+            default: shots = 0; optind = argc; break;
+        }
+    }
+    if (target >= 0 && optind == argc) return solve_main(&d, target);
+    if (shots <= 0 || optind < argc) {
+        fprintf(stderr, "Usage: %s                 (interactive)\n"
+                        "       %s --dispersion N [--speed V] [--angle DEG] [--mass KG] [--drag CD] [--power X] [--gravity G]\n"
+                        "             [--sd-mass PCT] [--sd-drag PCT] [--sd-power PCT] [--sd-angle DEG] [--seed S] [--threads N] [--bins N]\n"
+                        "       %s --target DIST [--speed V] [--mass KG] [--drag CD] [--power X] [--gravity G]\n",
+                argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    if (!(d.mass > 0)) {
+        fprintf(stderr, "--dispersion needs a positive mass\n");
+        return 1;
+    }
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (bins < 1) bins = 1;
+
+    double *distances = malloc(shots * sizeof(double));
+    long *counts = malloc(bins * sizeof(long));
+    if (distances == NULL || counts == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    double t0 = now_seconds();
+    dispersion_run(&d, shots, threads, distances);
+    double elapsed = now_seconds() - t0;
+
+    //shots that never came down are left out of the statistics
+    long n = 0;
+    for (long i = 0; i < shots; i++)
+        if (!isnan(distances[i])) distances[n++] = distances[i];
+    printf("%ld shots in %.3f s (%.2f M shots/s, %d threads, RK4 at %.5f s, %d-wide SIMD)\n",
+           shots, elapsed, shots / elapsed / 1e6, threads, RK4_STEP, VW);
+    printf("speed %.2f m/s x power %.2f (sd %.1f%%) | angle %.2f deg (sd %.2f) | mass %.2f kg (sd %.1f%%) | drag %.2f (sd %.1f%%) | G %.2f\n",
+           d.speed, d.power, d.sd_power * 100, d.angle * 180 / M_PI, d.sd_angle * 180 / M_PI,
+           d.mass, d.sd_mass * 100, d.drag_coefficient, d.sd_drag * 100, d.gravity);
+    if (n < shots) printf("%ld shots did not land within %.0f s\n", shots - n, BATCH_MAX_TIME);
+    if (n == 0) {
+        free(distances);
+        free(counts);
+        return 0;
+    }
+
+    double sum = 0, sum2 = 0;
+    for (long i = 0; i < n; i++) sum += distances[i];
+    double mean = sum / n;
+    for (long i = 0; i < n; i++) sum2 += (distances[i] - mean) * (distances[i] - mean);
+    qsort(distances, n, sizeof(double), compare_double);
+    printf("\nlanding distance: mean %.3f m | sd %.3f m | min %.3f m | max %.3f m\n",
+           mean, sqrt(sum2 / n), distances[0], distances[n - 1]);
+    static const double qs[] = {0.01, 0.05, 0.25, 0.50, 0.75, 0.95, 0.99};
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++)
+        printf("  p%-2d %10.3f m\n", (int)(qs[i] * 100 + 0.5), percentile(distances, n, qs[i]));
+
+    double lo = distances[0], hi = distances[n - 1];
+    histogram(distances, n, lo, hi, counts, bins);
+    long most = 1;
+    for (int b = 0; b < bins; b++) if (counts[b] > most) most = counts[b];
+    printf("\n");
+    for (int b = 0; b < bins; b++) {
+        double from = lo + (hi - lo) * b / bins, to = lo + (hi - lo) * (b + 1) / bins;
+        int bar = (int)(50.0 * counts[b] / most + 0.5);
+        printf("%9.3f - %9.3f m %9ld |", from, to, counts[b]);
+        for (int i = 0; i < bar; i++) putchar('#');
+        putchar('\n');
+    }
+    free(distances);
+    free(counts);
+    return 0;
+}
+
+//--------------------------------screen output--------------------------------
+
+//status lines above the field
+#define HUD_ROWS 3
+//unchanged cells worth resending to save a cursor move (ESC[r;cH is 6-10 bytes)
+#define MERGE_GAP 6
+
+/***********the whole terminal picture in one block: HUD_ROWS status lines, then the field with
+ the ground at the bottom. shown mirrors what the terminal displays so only changes are sent*****************/
+typedef struct {
+    int width, rows;
+    char *cells;     //rows * width, top line first
+    char *shown;     //0 marks a cell as unknown
+    char *out;       //escape sequences and changed runs for one write()
+    size_t out_cap;
+    int clear;       //wipe the terminal before the next frame
+} Framebuffer;
+
+int fb_create(Framebuffer *fb, int width, int rows) {
+    size_t cells = (size_t)width * rows;
+    fb->width = width;
+    fb->rows = rows;
+    fb->cells = malloc(cells);
+    fb->shown = calloc(cells, 1);
+    //worst case is every other cell changed: one cursor move per cell plus the clear
+    fb->out_cap = cells * 16 + 64;
+    fb->out = malloc(fb->out_cap);
+    fb->clear = 1;
+    if (fb->cells == NULL || fb->shown == NULL || fb->out == NULL) return 1;
+    memset(fb->cells, ' ', cells);
+    return 0;
+}
+
+void fb_free(Framebuffer *fb) {
+    free(fb->cells);
+    free(fb->shown);
+    free(fb->out);
+}
+
+/***********forget what the terminal shows, so the next frame is sent in full*****************/
+void fb_invalidate(Framebuffer *fb) {
+    memset(fb->shown, 0, (size_t)fb->width * fb->rows);
+    fb->clear = 1;
+}
+
+/***********cell at field position (x, y), y = 0 being the ground row; NULL if off the field*****************/
+char *fb_cell(Framebuffer *fb, int x, int y) {
+    int field_rows = fb->rows - HUD_ROWS;
+    if (x < 0 || x >= fb->width || y < 0 || y >= field_rows) return NULL;
+    return fb->cells + (size_t)(HUD_ROWS + field_rows - 1 - y) * fb->width + x;
+}
+
+void fb_clear_field(Framebuffer *fb) {
+    memset(fb->cells + (size_t)HUD_ROWS * fb->width, ' ', (size_t)(fb->rows - HUD_ROWS) * fb->width);
+}
+
+/***********status line row, cut or padded to the width*****************/
+void fb_text(Framebuffer *fb, int row, const char *text) {
+    char *dst = fb->cells + (size_t)row * fb->width;
+    int n = (int)strlen(text);
+    if (n > fb->width) n = fb->width;
+    memcpy(dst, text, n);
+    memset(dst + n, ' ', fb->width - n);
+}
+
+void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+char *put_uint(char *p, unsigned int v) {
+    char tmp[10];
+    int n = 0;
+    do tmp[n++] = (char)('0' + v % 10); while (v /= 10);
+    while (n > 0) *p++ = tmp[--n];
+    return p;
+}
+
+/***********sends the runs of cells that changed since the last frame, each behind a cursor move,
+ in a single write. runs separated by a few unchanged cells are joined*****************/
+void fb_present(Framebuffer *fb) {
+    char *p = fb->out;
+    if (fb->clear) {
+        memcpy(p, "\033[H\033[J", 6);
+        p += 6;
+        fb->clear = 0;
+    }
+    int w = fb->width;
+    for (int y = 0; y < fb->rows; y++) {
+        const char *row = fb->cells + (size_t)y * w;
+        char *shown = fb->shown + (size_t)y * w;
+        int x = 0;
+        while (x < w) {
+            if (row[x] == shown[x]) {
+                x++;
+                continue;
+            }
+            int end = x + 1, last = x;
+            while (end < w && end - last <= MERGE_GAP) {
+                if (row[end] != shown[end]) last = end;
+                end++;
+            }
+            *p++ = '\033';
+            *p++ = '[';
+            p = put_uint(p, (unsigned int)y + 1);
+            *p++ = ';';
+            p = put_uint(p, (unsigned int)x + 1);
+            *p++ = 'H';
+            memcpy(p, row + x, last + 1 - x);
+            memcpy(shown + x, row + x, last + 1 - x);
+            p += last + 1 - x;
+            x = last + 1;
+        }
+    }
+    if (p > fb->out) write_all(fb->out, p - fb->out);
+}
+
+//--------------------------------projectiles in the air--------------------------------
+
+#define MAX_SHOTS 8
+//field cells remembered per shot for its trail
+#define TRAIL_LENGTH 1024
+
+/***********one projectile: its trajectory, where it is now, and a ring buffer of the field
+ cells it has passed through*****************/
+typedef struct {
+    int in_use, flying;
+    Flight flight;
+    double sim_time;
+    State now;
+    int trail_x[TRAIL_LENGTH], trail_y[TRAIL_LENGTH];
+    int trail_head, trail_count; //next slot to write and number of cells kept
+} Shot;
+
+/***********appends a field cell to the trail unless the shot is still in the last one; the
+ oldest cell is dropped once the ring is full*****************/
+void trail_push(Shot *shot, int x, int y) {
+    if (shot->trail_count > 0) {
+        int last = (shot->trail_head - 1 + TRAIL_LENGTH) % TRAIL_LENGTH;
+        if (shot->trail_x[last] == x && shot->trail_y[last] == y) return;
+    }
+    shot->trail_x[shot->trail_head] = x;
+    shot->trail_y[shot->trail_head] = y;
+    shot->trail_head = (shot->trail_head + 1) % TRAIL_LENGTH;
+    if (shot->trail_count < TRAIL_LENGTH) shot->trail_count++;
+}
+
+void shot_launch(Shot *shot, Integrator integrator, const Physics *phys, double vx, double vy) {
+    shot->in_use = 1;
+    shot->flying = 1;
+    shot->sim_time = 0.0;
+    shot->now = (State){0, 0, vx, vy};
+    shot->trail_head = shot->trail_count = 0;
+    flight_start(&shot->flight, integrator, phys, shot->now);
+    trail_push(shot, 0, 0);
+}
+
+/***********moves a shot dt seconds on; returns 1 if it landed during them*****************/
+int shot_advance(Shot *shot, double dt) {
+    //simulated time follows the clock, but the trajectory is integrated in its own
+    //steps and sampled at that time, so it comes out the same at any frame rate
+    shot->sim_time += dt < 0.1 ? dt : 0.1;
+    Flight *flight = &shot->flight;
+    while (!flight->landed && flight->t1 < shot->sim_time) flight_step(flight);
+
+    //check for collision with the ground
+    int landed = flight->landed && shot->sim_time >= flight->t_land;
+    if (landed) {
+        shot->flying = 0;
+        shot->now = flight->at_land;
+    } else {
+        shot->now = flight_sample(flight, shot->sim_time);
+    }
+    trail_push(shot, (int)(shot->now.px * SCALE), (int)(shot->now.py * SCALE));
+    return landed;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) return batch_main(argc, argv);
+
     //get terminal dimensions
     struct winsize ws;
     ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
     int width = ws.ws_col;
     int height = ws.ws_row - 4; //reserve 4 rows for status info
 
-    //allocate screen buffer
-    char **screen = malloc(height * sizeof(char *));
-    if (screen == NULL) {
+    //one framebuffer for the status lines and the field
+    Framebuffer fb;
+    if (fb_create(&fb, width, HUD_ROWS + height) != 0) {
         fprintf(stderr, "Memory allocation failed\n");
         return 1;
     }
-    for (int y = 0; y < height; y++) {
-        screen[y] = malloc(width * sizeof(char));
-        if (screen[y] == NULL) {
-            fprintf(stderr, "Memory allocation failed\n");
-            //free previously allocated memory before exiting
-            for (int i = 0; i < y; i++) free(screen[i]);
-            free(screen);
-            return 1;
-        }
-    }
 
     //siumlation vars
     double aim_x = 10, aim_y = 5;
-    double v0 = 0, angle = 0;
-    double px = 0, py = 0, vx = 0, vy = 0;
+    Integrator integrator = INTEGRATOR_RK45;
+    double target_distance = 5.0; //meters, marked on the ground
+    static RangeTable range_cache;
+    AimSolution aim_hint = {0};
+
+    //projectiles in the air or landed with their trails; a new launch replaces the oldest
+    static Shot shots[MAX_SHOTS];
+    int next_shot = 0, last_landed = -1, newest = -1;
     
     //physics properties
     double mass = 1.0; //kg
@@ -107,10 +1227,19 @@ int main() {
 
     //show the settings menu to the user before starting
     valueSet_menu(&mass, &drag_coefficient, &gravity, &power, ws.ws_col, ws.ws_row);
-    
-    //game stateh 0=Aiming & 1=Flying & 2=Landed  .. no bounce
-    int gameState = 0;
-    double final_distance = 0.0;
+    fflush(stdout);
+
+    //raw input for the whole game; the frame tick comes from a timerfd
+    install_terminal_handlers();
+    raw_mode_enable();
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    struct itimerspec frame_tick = {{0, 1000000000L / FRAME_RATE}, {0, 1000000000L / FRAME_RATE}};
+    if (timer_fd < 0 || timerfd_settime(timer_fd, 0, &frame_tick, NULL) != 0) {
+        perror("timerfd");
+        return 1;
+    }
+    unsigned char keys[256];
+    int num_keys = 0, quit = 0;
 
     //time and fps calculation variables
     struct timespec ts_prev, ts_now;
@@ -118,7 +1247,27 @@ int main() {
     double fps = 0.0;
 
     // Main game loop
-    while (1) {
+    while (!quit) {
+        //sleep until the next frame tick, queueing the keys that arrive meanwhile
+        int tick = 0;
+        while (!tick) {
+            struct pollfd fds[2] = {{timer_fd, POLLIN, 0}, {num_keys < (int)sizeof(keys) ? STDIN_FILENO : -1, POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                perror("poll");
+                return 1;
+            }
+            if (fds[1].revents & (POLLIN | POLLHUP)) {
+                ssize_t n = read(STDIN_FILENO, keys + num_keys, sizeof(keys) - num_keys);
+                if (n > 0) num_keys += n;
+                else if (n == 0) keys[num_keys++] = 'q'; //stdin closed
+            }
+            if (fds[0].revents & POLLIN) {
+                uint64_t expirations; //more than 1 if a frame overran; those ticks are dropped
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) tick = 1;
+            }
+        }
+
         // Calculate delta time (dt) for physics calculations
         clock_gettime(CLOCK_MONOTONIC, &ts_now);
         double dt = (ts_now.tv_sec - ts_prev.tv_sec) +
@@ -126,139 +1275,166 @@ int main() {
         ts_prev = ts_now;
         if (dt > 0) fps = 0.9 * fps + 0.1 * (1.0 / dt); //fps counter smooth
 
-        //input handling
-        if (kbhit()) {
-            int c = getch_nonblock();
-            if (c == 'q') break;
+        //input handling: every key that came in since the last frame. aiming and
+        //launching work while other projectiles are still in the air
+        for (int k = 0; k < num_keys; k++) {
+            int c = keys[k];
+            if (c == 'q') {
+                quit = 1;
+                break;
+            }
             
-            if (gameState == 0) { 
-                if (c == 'w' && aim_y < height - 2) aim_y++;
-                if (c == 's' && aim_y > 1) aim_y--;
-                if (c == 'a' && aim_x > 1) aim_x--;
-                if (c == 'd' && aim_x < width - 2) aim_x++;
-                if (c == 'm') {
-                    valueSet_menu(&mass, &drag_coefficient, &gravity, &power, ws.ws_col, ws.ws_row);
-                }
-                if (c == '\n' || c ==' ') {
-                    double dx = aim_x;
-                    double dy = aim_y;
-                    //calculate initial velocity based on aim and power
-                    v0 = (sqrt(dx*dx + dy*dy) / SCALE) * power;
-                    angle = atan2(dy, dx);
-                    px = 0; py = 0;
-                    vx = v0 * cos(angle);
-                    vy = v0 * sin(angle);
-                    gameState = 1; //switch to flying state
+            if (c == 'w' && aim_y < height - 2) aim_y++;
+            if (c == 's' && aim_y > 1) aim_y--;
+            if (c == 'a' && aim_x > 1) aim_x--;
+            if (c == 'd' && aim_x < width - 2) aim_x++;
+            if (c == 'i') integrator = (integrator + 1) % INTEGRATOR_COUNT;
+            if (c == 'j' && target_distance >= 1 / SCALE) target_distance -= 1 / SCALE;
+            if (c == 'l' && target_distance * SCALE < width - 1) target_distance += 1 / SCALE;
+            if ((c == 'g' || c == 'h') && physics_aimable(&(Physics){mass, drag_coefficient, gravity})) {
+                //turn the aim onto the low or high arc, keeping its length (the launch speed)
+                Physics phys = {mass, drag_coefficient, gravity};
+                double r = sqrt(aim_x*aim_x + aim_y*aim_y);
+                const RangeTable *tab = range_table(&range_cache, &phys);
+                AimSolution sol = solve_aim(tab, &phys, r / SCALE * power, target_distance, 1);
+                if (c == 'g' ? sol.low_ok : sol.high_ok) {
+                    double a = c == 'g' ? sol.low : sol.high;
+                    aim_x = r * cos(a);
+                    aim_y = r * sin(a);
                 }
-            } else if (gameState == 2) { //landed state
-                gameState = 0;
             }
-            
+            if (c == 'm') {
+                //the menu reads whole lines; keys typed before it opened are dropped
+                raw_mode_disable();
+                valueSet_menu(&mass, &drag_coefficient, &gravity, &power, ws.ws_col, ws.ws_row);
+                fflush(stdout);
+                raw_mode_enable();
+                fb_invalidate(&fb); //the menu drew over everything
+                k = num_keys;
+            }
+            if (c == '\n' || c ==' ') {
+                double dx = aim_x;
+                double dy = aim_y;
+                //calculate initial velocity based on aim and power
+                double v0 = (sqrt(dx*dx + dy*dy) / SCALE) * power;
+                double angle = atan2(dy, dx);
+                Physics phys = {mass, drag_coefficient, gravity};
+                newest = next_shot;
+                next_shot = (next_shot + 1) % MAX_SHOTS;
+                shot_launch(&shots[newest], integrator, &phys, v0 * cos(angle), v0 * sin(angle));
+            }
             if (c == 'r') { //reset simulation
-                gameState = 0;
                 aim_x = 10;
                 aim_y = 5;
+                for (int n = 0; n < MAX_SHOTS; n++) shots[n].in_use = 0;
+                last_landed = newest = -1;
             }
         }
+        num_keys = 0;
+        if (quit) break;
 
         //physic updation
-        if (gameState == 1) {
-            double speed = sqrt(vx*vx + vy*vy);
-            //calculate drag force
-            double force_drag_magnitude = 0.5 * drag_coefficient * speed * speed;
-            double force_drag_x = -force_drag_magnitude * (vx / (speed + 1e-9)); //avoid division by zero <3
-            double force_drag_y = -force_drag_magnitude * (vy / (speed + 1e-9));
-            
-            //net force is drag + gravity
-            double force_net_x = force_drag_x;
-            double force_net_y = force_drag_y - (gravity * mass);
-
-            //calculate acceleration (a = f/m)
-            double ax = force_net_x / mass;
-            double ay = force_net_y / mass;
-
-            //euler integration to velcoity and positon updation
-            vx += ax * dt;
-            vy += ay * dt;
-            px += vx * dt;
-            py += vy * dt;
-            
-            //check for collision with the ground
-            if (py < 0) {
-                final_distance = px;
-                gameState = 2; //switch to landed state
-            }
+        int flying = 0;
+        for (int n = 0; n < MAX_SHOTS; n++) {
+            if (!shots[n].in_use || !shots[n].flying) continue;
+            if (shot_advance(&shots[n], dt)) last_landed = n;
+            else flying++;
         }
 
-        //draw canvas
-        //clear the screen buffer
-        for (int y = 0; y < height; y++)
-            for (int x = 0; x < width; x++)
-                screen[y][x] = ' ';
-
-        //draw ground
-        for (int x = 0; x < width; x++) screen[0][x] = '_';
-
-        //draw based on game state
-        if (gameState == 1) { //flying
-            int sx = (int)(px * SCALE);
-            int sy = (int)(py * SCALE);
-            if (sx >= 0 && sx < width && sy >= 0 && sy < height)
-                screen[sy][sx] = 'O'; //draw projectile
-        } else if (gameState == 0) {
-            screen[(int)aim_y][(int)aim_x] = '+';
-        } else if (gameState == 2) {
-            char message[100];
-            sprintf(message, "Distance Covered: %.2f meters", final_distance);
-            int msg_start_x = (width - strlen(message)) / 2;
-            int y_pos = height / 2;
-            for(int i = 0; i < strlen(message); i++) {
-                if ((msg_start_x + i) < width && (msg_start_x + i) >= 0) {
-                    screen[y_pos][msg_start_x + i] = message[i];
-                }
+        //aim suggestion for the target from the range table (microseconds once the table exists)
+        Physics phys = {mass, drag_coefficient, gravity};
+        int aimable = physics_aimable(&phys);
+        if (aimable) {
+            const RangeTable *tab = range_table(&range_cache, &phys);
+            aim_hint = solve_aim(tab, &phys, sqrt(aim_x*aim_x + aim_y*aim_y) / SCALE * power, target_distance, 0);
+        } else {
+            aim_hint = (AimSolution){0};
+        }
+
+        //draw canvas: ground, target, trails, projectiles, aim
+        fb_clear_field(&fb);
+        for (int x = 0; x < width; x++) *fb_cell(&fb, x, 0) = '_';
+        int tx = (int)(target_distance * SCALE);
+        if (tx >= 0 && tx < width) *fb_cell(&fb, tx, 0) = 'X';
+        for (int n = 0; n < MAX_SHOTS; n++) {
+            const Shot *shot = &shots[n];
+            if (!shot->in_use) continue;
+            for (int t = 0; t < shot->trail_count; t++) {
+                int at = (shot->trail_head - 1 - t + TRAIL_LENGTH) % TRAIL_LENGTH;
+                char *cell = fb_cell(&fb, shot->trail_x[at], shot->trail_y[at]);
+                if (cell && *cell == ' ') *cell = '.';
             }
         }
+        for (int n = 0; n < MAX_SHOTS; n++) {
+            char *cell = shots[n].in_use && shots[n].flying ? fb_cell(&fb, (int)(shots[n].now.px * SCALE), (int)(shots[n].now.py * SCALE)) : NULL;
+            if (cell) *cell = 'O'; //draw projectile
+        }
+        //where the aim would have to be to hit the target
+        double r = sqrt(aim_x*aim_x + aim_y*aim_y);
+        for (int arc = 0; arc < 2; arc++) {
+            if (!(arc == 0 ? aim_hint.low_ok : aim_hint.high_ok)) continue;
+            double a = arc == 0 ? aim_hint.low : aim_hint.high;
+            char *cell = fb_cell(&fb, (int)(r * cos(a)), (int)(r * sin(a)));
+            if (cell && r * sin(a) >= 1) *cell = '*';
+        }
+        char *cursor = aim_x >= 0 && aim_y >= 0 ? fb_cell(&fb, (int)aim_x, (int)aim_y) : NULL;
+        if (cursor) *cursor = '+';
 
-        //render to terminal
-        clear_screen();
-        
-        //print status infos
-        if (gameState == 1) {
-            printf("FPS: %.1f | H-Speed: %.2f m/s | V-Speed: %.2f m/s\n", fps, vx, vy);
-            printf("Mass: %.2f kg | Gravity: %.2f m/s^2\n", mass, gravity);
-            printf("\n");
-        } else if (gameState == 0) {
-            double potential_v0 = (sqrt(aim_x*aim_x + aim_y*aim_y) / SCALE) * power;
-            double visual_x = aim_x /2;
-            double potential_angle = atan2(aim_y, visual_x);
-            double potential_vx = potential_v0 * cos(potential_angle);
-            double potential_vy = potential_v0 * sin(potential_angle);
-            
-            printf("FPS: %.1f | Potential H-Speed: %.2f m/s | Potential V-Speed: %.2f m/s\n", fps, potential_vx, potential_vy);
-            printf("Cursor Angle: %.1f deg | Mass: %.2f kg | Power: %.1fx | Planet (G=%.2f)\n", potential_angle * 180.0 / M_PI, mass, power, gravity);
-            printf("[W/S/A/D] to Aim | [Enter] to Launch | [M] Menu | [R] Reset | [Q] Quit\n");
-        } else {
-            printf("FPS: %.1f | Landed!\n", fps);
-            printf("Final distance is shown below.\n");
-            printf("Press any key to aim again.\n");
+        char line[512];
+        if (flying == 0 && last_landed >= 0) {
+            snprintf(line, sizeof(line), "Distance Covered: %.2f meters", shots[last_landed].flight.at_land.px);
+            int msg_start_x = (width - (int)strlen(line)) / 2;
+            for (int i = 0; line[i]; i++) {
+                char *cell = fb_cell(&fb, msg_start_x + i, height / 2);
+                if (cell) *cell = line[i];
+            }
         }
 
-        //print the screen buffer from bottom to top
-        for (int y = height-1; y >= 0; y--) {
-            for (int x = 0; x < width; x++)
-                putchar(screen[y][x]);
-            putchar('\n');
+        //status infos
+        double potential_v0 = (sqrt(aim_x*aim_x + aim_y*aim_y) / SCALE) * power;
+        double visual_x = aim_x /2;
+        double potential_angle = atan2(aim_y, visual_x);
+        double potential_vx = potential_v0 * cos(potential_angle);
+        double potential_vy = potential_v0 * sin(potential_angle);
+        char hint[128], arc[2][32];
+        for (int k = 0; k < 2; k++) {
+            if (k == 0 ? aim_hint.low_ok : aim_hint.high_ok)
+                snprintf(arc[k], sizeof(arc[k]), "%.1f deg", (k == 0 ? aim_hint.low : aim_hint.high) * 180.0 / M_PI);
+            else
+                snprintf(arc[k], sizeof(arc[k]), "no solution");
         }
+        if (!aimable)
+            snprintf(hint, sizeof(hint), "Target %.1f m: no aim hint for these physics", target_distance);
+        else if (aim_hint.low_ok || aim_hint.high_ok)
+            snprintf(hint, sizeof(hint), "Target %.1f m: aim %s (low) / %s (high), now %.1f deg", target_distance,
+                     arc[0], arc[1], atan2(aim_y, aim_x) * 180.0 / M_PI);
+        else
+            snprintf(hint, sizeof(hint), "Target %.1f m: out of reach (max %.1f m at this speed)", target_distance, aim_hint.max_range);
+        snprintf(line, sizeof(line), "FPS: %.1f | Potential H-Speed: %.2f m/s | Potential V-Speed: %.2f m/s | %s", fps, potential_vx, potential_vy, hint);
+        fb_text(&fb, 0, line);
+
+        char shot_info[160] = "";
+        if (newest >= 0 && shots[newest].in_use && shots[newest].flying)
+            snprintf(shot_info, sizeof(shot_info), " | In flight: %d, newest H-Speed: %.2f m/s V-Speed: %.2f m/s",
+                     flying, shots[newest].now.vx, shots[newest].now.vy);
+        else if (last_landed >= 0)
+            snprintf(shot_info, sizeof(shot_info), " | Landed at %.2f m (%s, %.3f s flight, %ld force evaluations)",
+                     shots[last_landed].flight.at_land.px, integrator_names[shots[last_landed].flight.integrator],
+                     shots[last_landed].flight.t_land, shots[last_landed].flight.evals);
+        snprintf(line, sizeof(line), "Cursor Angle: %.1f deg | Mass: %.2f kg | Power: %.1fx | Planet (G=%.2f)%s",
+                 potential_angle * 180.0 / M_PI, mass, power, gravity, shot_info);
+        fb_text(&fb, 1, line);
+        snprintf(line, sizeof(line), "[W/S/A/D] Aim | [J/L] Target | [G/H] Low/High Arc | [Enter] Launch | [I] Integrator: %s | [M] Menu | [R] Reset | [Q] Quit",
+                 integrator_names[integrator]);
+        fb_text(&fb, 2, line);
 
-        //60fps
-        usleep(16000);
+        //render to terminal: only what changed, in one write
+        fb_present(&fb);
     }
+    close(timer_fd);
 
     ///free
-    for (int y = 0; y < height; y++) {
-        free(screen[y]);
-    }
-    free(screen);
+    fb_free(&fb);
 
     return 0;
 }